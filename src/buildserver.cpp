@@ -0,0 +1,292 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "buildserver.h"
+#include "logger.h"
+
+#include <cstring>
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+// Relative to the build directory, the current directory of both the client and the server.
+static const char SocketName[] = "meique.sock";
+// Time to wait for a new server to start listening.
+static const int ServerStartTimeout = 5000;
+// Command line arguments never come close to this, anything bigger is a broken client.
+static const uint32_t MaxPayloadSize = 1 << 20;
+
+static sockaddr_un socketAddress()
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, SocketName);
+    return address;
+}
+
+static int connectToServer()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    sockaddr_un address = socketAddress();
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size) {
+        ssize_t written = write(fd, ptr, size);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        ptr += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size)
+{
+    char* ptr = static_cast<char*>(data);
+    while (size) {
+        ssize_t bytesRead = read(fd, ptr, size);
+        if (bytesRead == -1 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            return false;
+        ptr += bytesRead;
+        size -= bytesRead;
+    }
+    return true;
+}
+
+BuildServer::BuildServer()
+    : m_fd(-1)
+    , m_nullFd(open("/dev/null", O_RDWR | O_CLOEXEC))
+{
+    // Clients may go away while their build is running.
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return;
+    sockaddr_un address = socketAddress();
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) && errno == EADDRINUSE) {
+        // A socket left by a server that died is removed, a live one is left alone.
+        int otherServer = connectToServer();
+        if (otherServer != -1) {
+            close(otherServer);
+            close(fd);
+            return;
+        }
+        unlink(SocketName);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+            close(fd);
+            return;
+        }
+    }
+    if (listen(fd, 16)) {
+        close(fd);
+        return;
+    }
+    m_fd = fd;
+}
+
+BuildServer::~BuildServer()
+{
+    if (m_fd != -1) {
+        unlink(SocketName);
+        close(m_fd);
+    }
+    close(m_nullFd);
+}
+
+bool BuildServer::waitForRequest(int timeout, Request& request)
+{
+    while (true) {
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        int res = poll(&pfd, 1, timeout);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+
+        int connection = accept4(m_fd, 0, 0, SOCK_CLOEXEC);
+        if (connection == -1)
+            continue;
+
+        // The message has the payload size, the client verbosity level and the arguments separated by
+        // null characters, the client output and error fds come along.
+        uint32_t header[2];
+        int fds[2] = { -1, -1 };
+        iovec iov;
+        iov.iov_base = header;
+        iov.iov_len = sizeof(header);
+        char control[CMSG_SPACE(sizeof(fds))];
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        std::string payload;
+        bool ok = recvmsg(connection, &message, MSG_CMSG_CLOEXEC) == sizeof(header);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        if (ok && cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+            std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        else
+            ok = false;
+        if (ok && header[0] > MaxPayloadSize)
+            ok = false;
+        if (ok) {
+            payload.resize(header[0]);
+            ok = readAll(connection, &payload[0], payload.size());
+        }
+        if (!ok) {
+            close(fds[0]);
+            close(fds[1]);
+            close(connection);
+            continue;
+        }
+
+        request.args.clear();
+        for (size_t pos = 0; pos < payload.size();) {
+            size_t end = payload.find('\0', pos);
+            request.args.push_back(payload.substr(pos, end - pos));
+            if (end == std::string::npos)
+                break;
+            pos = end + 1;
+        }
+        request.verbosityLevel = header[1];
+        request.connection = connection;
+        request.outputFd = fds[0];
+        request.errorFd = fds[1];
+        return true;
+    }
+}
+
+void BuildServer::beginRequest(const Request& request)
+{
+    dup2(request.outputFd, STDOUT_FILENO);
+    dup2(request.errorFd, STDERR_FILENO);
+}
+
+void BuildServer::finishRequest(const Request& request, bool success, const std::string& errorMessage)
+{
+    std::cout.flush();
+    std::cerr.flush();
+    dup2(m_nullFd, STDOUT_FILENO);
+    dup2(m_nullFd, STDERR_FILENO);
+    close(request.outputFd);
+    close(request.errorFd);
+
+    const uint32_t result[2] = { success, uint32_t(errorMessage.size()) };
+    if (writeAll(request.connection, result, sizeof(result)))
+        writeAll(request.connection, errorMessage.data(), errorMessage.size());
+    close(request.connection);
+}
+
+int BuildServer::connect()
+{
+    int fd = connectToServer();
+    if (fd != -1)
+        return fd;
+
+    pid_t pid = fork();
+    if (pid == -1)
+        throw Error("Unable to start the build server.");
+    if (!pid) {
+        // Detach from the terminal of the client that started us.
+        setsid();
+        int nullFd = open("/dev/null", O_RDWR);
+        dup2(nullFd, STDIN_FILENO);
+        dup2(nullFd, STDOUT_FILENO);
+        dup2(nullFd, STDERR_FILENO);
+        close(nullFd);
+        return -1;
+    }
+
+    for (int elapsed = 0; elapsed < ServerStartTimeout; elapsed += 10) {
+        usleep(10000);
+        fd = connectToServer();
+        if (fd != -1)
+            return fd;
+    }
+    throw Error("Unable to connect to the build server.");
+}
+
+void BuildServer::sendRequest(int fd, const StringList& args)
+{
+    std::string payload;
+    for (const std::string& arg : args) {
+        payload += arg;
+        payload += '\0';
+    }
+
+    uint32_t header[2] = { uint32_t(payload.size()), uint32_t(::verbosityLevel) };
+    iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    const int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &message, 0) != sizeof(header) || !writeAll(fd, payload.data(), payload.size()))
+        throw Error("Unable to send the request to the build server.");
+}
+
+bool BuildServer::receiveResult(int fd, std::string& errorMessage)
+{
+    uint32_t result[2];
+    if (!readAll(fd, result, sizeof(result)))
+        throw Error("Lost the connection with the build server.");
+    errorMessage.resize(result[1]);
+    if (!errorMessage.empty() && !readAll(fd, &errorMessage[0], errorMessage.size()))
+        throw Error("Lost the connection with the build server.");
+    return result[0];
+}
@@ -0,0 +1,72 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUILDSERVER_H
+#define BUILDSERVER_H
+
+#include "basictypes.h"
+
+/**
+ * Unix socket used to talk with the build server of a build directory.
+ *
+ * The server keeps the project loaded between builds, clients send their command line arguments
+ * together with their standard output and error file descriptors, so the output of the build goes
+ * straight to the client terminal, and wait for the build result.
+ */
+class BuildServer
+{
+public:
+    struct Request {
+        StringList args;
+        int verbosityLevel;
+        int connection;
+        int outputFd;
+        int errorFd;
+    };
+
+    /// Listen for clients in the current build directory, if there's no other server listening there.
+    BuildServer();
+    ~BuildServer();
+
+    bool isListening() const { return m_fd != -1; }
+    /// Wait up to \p timeout milliseconds for a client request, returns false on timeout.
+    bool waitForRequest(int timeout, Request& request);
+    /// Redirect the standard output and error to the client ones while the request is handled.
+    void beginRequest(const Request& request);
+    /// Send the build result to the client and close the connection.
+    void finishRequest(const Request& request, bool success, const std::string& errorMessage);
+
+    /**
+     * Connect to the build server of the current build directory, starting one in a new process if there's none.
+     *
+     * Returns the connection, or -1 in the new process, that must run the server.
+     */
+    static int connect();
+    /// Ask the server connected on \p fd to build using the command line arguments \p args.
+    static void sendRequest(int fd, const StringList& args);
+    /// Wait for the result of the request sent on \p fd, false if the build failed.
+    static bool receiveResult(int fd, std::string& errorMessage);
+
+    BuildServer(const BuildServer&) = delete;
+    BuildServer& operator=(const BuildServer&) = delete;
+private:
+    int m_fd;
+    int m_nullFd;
+};
+
+#endif
@@ -0,0 +1,248 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Minimal server for the meique remote cache, storing the blobs sent with PUT as files in a directory.
+
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+static const size_t MaxHeaderSize = 64 * 1024;
+
+static std::string storageDir;
+
+static void showHelp()
+{
+    std::cout << "Usage: meique-cache-server [OPTIONS]\n\n";
+    std::cout << "Serve a meique remote cache, storing the objects in a directory.\n\n";
+    std::cout << " --listen=[ADDRESS:]PORT            Listen on a TCP port, default to 8080.\n";
+    std::cout << " --listen=unix:PATH                 Listen on a Unix socket.\n";
+    std::cout << " --dir=DIRECTORY                    Where to store the objects, default to the\n";
+    std::cout << "                                    current directory.\n";
+}
+
+// Blobs are stored in a flat directory, the path is checked so nothing outside it can be touched.
+static bool fileForPath(const std::string& path, std::string& fileName)
+{
+    if (path.size() < 2 || path[0] != '/' || path.find("..") != std::string::npos)
+        return false;
+    fileName = storageDir;
+    for (size_t i = 1; i < path.size(); ++i) {
+        const char c = path[i];
+        if (c == '/')
+            fileName += '_';
+        else if (std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '-' || c == '_')
+            fileName += c;
+        else
+            return false;
+    }
+    return true;
+}
+
+static bool sendAll(int fd, const std::string& data)
+{
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t bytes = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (bytes <= 0)
+            return false;
+        sent += bytes;
+    }
+    return true;
+}
+
+static bool sendResponse(int fd, int status, const char* reason, const std::string& body = std::string())
+{
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << ' ' << reason << "\r\nContent-Length: " << body.size() << "\r\n\r\n" << body;
+    return sendAll(fd, response.str());
+}
+
+static void handleConnection(int fd)
+{
+    static unsigned tmpFiles = 0;
+    std::string data;
+    char buffer[64 * 1024];
+    while (true) {
+        size_t headerEnd;
+        while ((headerEnd = data.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t bytes = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (bytes <= 0 || data.size() > MaxHeaderSize) {
+                ::close(fd);
+                return;
+            }
+            data.append(buffer, bytes);
+        }
+
+        std::istringstream headers(data.substr(0, headerEnd));
+        std::string method;
+        std::string path;
+        headers >> method >> path;
+        size_t contentLength = 0;
+        std::string line;
+        while (std::getline(headers, line)) {
+            if (strncasecmp(line.c_str(), "content-length:", 15) == 0)
+                contentLength = std::strtoull(line.c_str() + 15, 0, 10);
+        }
+
+        data.erase(0, headerEnd + 4);
+        while (data.size() < contentLength) {
+            ssize_t bytes = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (bytes <= 0) {
+                ::close(fd);
+                return;
+            }
+            data.append(buffer, bytes);
+        }
+        const std::string body = data.substr(0, contentLength);
+        data.erase(0, contentLength);
+
+        std::string fileName;
+        bool ok;
+        if (!fileForPath(path, fileName)) {
+            ok = sendResponse(fd, 400, "Bad Request");
+        } else if (method == "GET") {
+            std::ifstream file(fileName.c_str(), std::ios::binary);
+            std::ostringstream content;
+            if (file && content << file.rdbuf())
+                ok = sendResponse(fd, 200, "OK", content.str());
+            else
+                ok = sendResponse(fd, 404, "Not Found");
+        } else if (method == "PUT") {
+            // Written with a temporary name, so nobody reads half written files.
+            const std::string tmpFile = fileName + ".tmp" + std::to_string(__sync_fetch_and_add(&tmpFiles, 1));
+            std::ofstream file(tmpFile.c_str(), std::ios::binary | std::ios::trunc);
+            if (file.write(body.data(), body.size()).flush() && !std::rename(tmpFile.c_str(), fileName.c_str())) {
+                ok = sendResponse(fd, 200, "OK");
+            } else {
+                std::remove(tmpFile.c_str());
+                ok = sendResponse(fd, 500, "Internal Server Error");
+            }
+        } else {
+            ok = sendResponse(fd, 405, "Method Not Allowed");
+        }
+        if (!ok)
+            break;
+    }
+    ::close(fd);
+}
+
+static int listenOn(const std::string& address)
+{
+    int fd = -1;
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un unixAddress;
+        const std::string path = address.substr(5);
+        if (path.size() >= sizeof(unixAddress.sun_path))
+            return -1;
+        std::memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        std::strcpy(unixAddress.sun_path, path.c_str());
+        ::unlink(path.c_str());
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && ::bind(fd, reinterpret_cast<sockaddr*>(&unixAddress), sizeof(unixAddress))) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        const size_t colon = address.rfind(':');
+        const std::string host = colon == std::string::npos ? std::string() : address.substr(0, colon);
+        const std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* addresses;
+        if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses))
+            return -1;
+        for (addrinfo* info = addresses; info && fd == -1; info = info->ai_next) {
+            fd = ::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+            int enabled = 1;
+            if (fd != -1)
+                ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+            if (fd != -1 && ::bind(fd, info->ai_addr, info->ai_addrlen)) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(addresses);
+    }
+
+    if (fd != -1 && ::listen(fd, 128)) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char** argv)
+{
+    std::string address = "8080";
+    storageDir = ".";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 9, "--listen=") == 0) {
+            address = arg.substr(9);
+        } else if (arg.compare(0, 6, "--dir=") == 0) {
+            storageDir = arg.substr(6);
+        } else {
+            showHelp();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (storageDir.empty() || storageDir[storageDir.size() - 1] != '/')
+        storageDir += '/';
+    ::mkdir(storageDir.c_str(), 0755);
+
+    std::signal(SIGPIPE, SIG_IGN);
+    int serverFd = listenOn(address);
+    if (serverFd == -1) {
+        std::cerr << "Unable to listen on " << address << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cout << "Serving " << storageDir << " on " << address << std::endl;
+
+    while (true) {
+        int fd = ::accept4(serverFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "Error accepting connections: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        std::thread(handleConnection, fd).detach();
+    }
+}
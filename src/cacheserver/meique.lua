@@ -0,0 +1,5 @@
+cacheServer = Executable:new("meique-cache-server")
+GCC:addCustomFlags("-std=c++0x")
+cacheServer:addFiles("cacheserver.cpp")
+cacheServer:addLinkLibraries("pthread")
+UNIX:cacheServer:install("bin")
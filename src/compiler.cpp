@@ -43,3 +43,8 @@ std::string Compiler::nameForObject(const std::string& name, const std::string&
 {
     return name + '.' + target + ".o";
 }
+
+std::string Compiler::nameForPrecompiledHeader(const std::string& name, const std::string& target) const
+{
+    return name + '.' + target + ".gch";
+}
@@ -24,6 +24,7 @@
 
 class LinkerOptions;
 class CompilerOptions;
+class DepsLog;
 
 enum Language {
     CLanguage,
@@ -41,13 +42,21 @@ class Compiler
 public:
     Compiler() {}
     virtual ~Compiler() {}
-    virtual std::string compile(const std::string& fileName, const std::string& output, const CompilerOptions* options) = 0;
-    virtual std::string link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const = 0;
+    /// Returns the command line, program and arguments, used to compile \p fileName.
+    virtual StringList compile(const std::string& fileName, const std::string& output, const CompilerOptions* options) = 0;
+    /// Returns the command line, program and arguments, used to precompile the C++ \p header into \p output.
+    virtual StringList precompileHeader(const std::string& header, const std::string& output, const CompilerOptions* options) = 0;
+    /// Returns the command line, program and arguments, used to link \p output.
+    virtual StringList link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const = 0;
     virtual std::string nameForExecutable(const std::string& name) const = 0;
     virtual std::string nameForStaticLibrary(const std::string& name) const = 0;
     virtual std::string nameForSharedLibrary(const std::string& name) const = 0;
     virtual std::string nameForObject(const std::string& name, const std::string& target) const;
-    virtual bool shouldCompile(const std::string& source, const std::string& output) const = 0;
+    virtual std::string nameForPrecompiledHeader(const std::string& name, const std::string& target) const;
+    /// Returns true if \p output is older than \p source or any of the dependencies recorded in \p depsLog.
+    virtual bool shouldCompile(const std::string& source, const std::string& output, DepsLog& depsLog) const = 0;
+    /// Record in \p depsLog the dependencies found by the compiler when \p output was compiled.
+    virtual bool ingestDependencies(const std::string& output, DepsLog& depsLog) const = 0;
 private:
     Compiler(const Compiler&) = delete;
 };
@@ -49,6 +49,18 @@ void CompilerOptions::addCustomFlag(const std::string& customFlag)
     m_customFlags.push_back(customFlag);
 }
 
+void CompilerOptions::addPathPrefixMap(const std::string& from, const std::string& to)
+{
+    m_pathPrefixMaps.push_back(from + '=' + to);
+}
+
+bool CompilerOptions::canUsePrecompiledHeaderOf(const CompilerOptions& other) const
+{
+    return m_includePaths == other.m_includePaths && m_defines == other.m_defines && m_customFlags == other.m_customFlags
+        && m_pathPrefixMaps == other.m_pathPrefixMaps && m_compileForLibrary == other.m_compileForLibrary
+        && m_debugInfoEnabled == other.m_debugInfoEnabled;
+}
+
 void CompilerOptions::normalize()
 {
     // FIXME: Can't sort include paths or custom flags because this can cause compilation problems
@@ -67,12 +79,3 @@ void CompilerOptions::merge(const CompilerOptions& other)
     copy(m_defines, other.m_defines);
     copy(m_customFlags, other.m_customFlags);
 }
-
-std::string CompilerOptions::hash() const
-{
-    return join(m_includePaths, ":") + ','
-           + join(m_defines, ":") + ','
-           + join(m_customFlags, ":") + ','
-           + (m_compileForLibrary ? '1' : '0')
-           + (m_debugInfoEnabled ? '1' : '0');
-}
@@ -36,14 +36,23 @@ public:
     bool compileForLibrary() const { return m_compileForLibrary; }
     void enableDebugInfo() { m_debugInfoEnabled = true; }
     bool debugInfoEnabled() const { return m_debugInfoEnabled; }
+    /// Paths starting with \p from are written as starting with \p to in the objects, later maps have precedence.
+    void addPathPrefixMap(const std::string& from, const std::string& to);
+    StringList pathPrefixMaps() const { return m_pathPrefixMaps; }
+    /// Precompiled header used by C++ files.
+    void setPrecompiledHeader(const std::string& output) { m_precompiledHeader = output; }
+    std::string precompiledHeader() const { return m_precompiledHeader; }
+    /// True if a precompiled header built with \p other can be used with these options, headers must also be found in the same places.
+    bool canUsePrecompiledHeaderOf(const CompilerOptions& other) const;
     void normalize();
 
     void merge(const CompilerOptions& other);
-    std::string hash() const;
 private:
     StringList m_includePaths;
     StringList m_defines;
     StringList m_customFlags;
+    StringList m_pathPrefixMaps;
+    std::string m_precompiledHeader;
     bool m_compileForLibrary;
     bool m_debugInfoEnabled;
 
@@ -0,0 +1,507 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "depslog.h"
+#include "logger.h"
+#include "os.h"
+#include "filehash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+extern "C" {
+#include <stdint.h>
+#include <unistd.h>
+}
+
+static const char Magic[] = "# meiquedeps\n";
+static const uint32_t Version = 1;
+
+enum RecordType {
+    PathRecord,
+    DepsRecord,
+    FileHashRecord,
+    InputsHashRecord,
+    CommandHashRecord,
+    InterfaceHashRecord
+};
+
+static const uint32_t MaxRecordSize = (1 << 28) - 1;
+
+template<typename T>
+static void appendInt(std::string& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+static T readInt(const char* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+DepsLog::DepsLog()
+    : m_records(0)
+{
+}
+
+DepsLog::~DepsLog()
+{
+    close();
+}
+
+void DepsLog::open(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileName = fileName;
+    if (!load()) {
+        m_paths.clear();
+        m_pathIds.clear();
+        m_deps.clear();
+        m_fileHashes.clear();
+        m_inputsHashes.clear();
+        m_commandHashes.clear();
+        m_interfaceHashes.clear();
+        m_records = 0;
+        m_file.open(m_fileName.c_str(), std::ios::binary | std::ios::out | std::ios::trunc);
+        m_file.write(Magic, sizeof(Magic) - 1);
+        m_file.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+        m_file.flush();
+    }
+}
+
+bool DepsLog::load()
+{
+    std::ifstream file(m_fileName.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream content;
+    content << file.rdbuf();
+    const std::string data = content.str();
+
+    const size_t headerSize = sizeof(Magic) - 1 + sizeof(Version);
+    if (data.size() < headerSize || data.compare(0, sizeof(Magic) - 1, Magic) != 0
+        || readInt<uint32_t>(data.data() + sizeof(Magic) - 1) != Version) {
+        Debug() << "Discarding dependency log " << m_fileName << ", unknown format.";
+        return false;
+    }
+
+    size_t pos = headerSize;
+    while (pos + sizeof(uint32_t) <= data.size()) {
+        const uint32_t header = readInt<uint32_t>(data.data() + pos);
+        const unsigned type = header >> 28;
+        const size_t size = header & MaxRecordSize;
+        const char* payload = data.data() + pos + sizeof(uint32_t);
+        if (pos + sizeof(uint32_t) + size > data.size() || size % 4)
+            break;
+
+        if (type == PathRecord) {
+            // The path, padded with zeros, and the complement of its id as a checksum.
+            if (size < sizeof(uint32_t))
+                break;
+            const unsigned id = m_paths.size();
+            if (readInt<uint32_t>(payload + size - sizeof(uint32_t)) != ~id)
+                break;
+            std::string path(payload, strnlen(payload, size - sizeof(uint32_t)));
+            m_pathIds[path] = id;
+            m_paths.push_back(path);
+        } else if (type == DepsRecord) {
+            // The output id, its modification time and the ids of its dependencies.
+            if (size < sizeof(uint32_t) + sizeof(int64_t))
+                break;
+            const unsigned outputId = readInt<uint32_t>(payload);
+            Deps deps;
+            deps.outputTime = readInt<int64_t>(payload + sizeof(uint32_t));
+            bool valid = outputId < m_paths.size();
+            for (size_t i = sizeof(uint32_t) + sizeof(int64_t); i < size; i += sizeof(uint32_t)) {
+                deps.ids.push_back(readInt<uint32_t>(payload + i));
+                valid = valid && deps.ids.back() < m_paths.size();
+            }
+            if (!valid)
+                break;
+            m_deps[outputId] = std::move(deps);
+            m_records++;
+        } else if (type == FileHashRecord) {
+            // The file id, its modification time and the hash of its contents.
+            if (size != sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint64_t))
+                break;
+            const unsigned id = readInt<uint32_t>(payload);
+            if (id >= m_paths.size())
+                break;
+            FileHash& fileHash = m_fileHashes[id];
+            fileHash.modificationTime = readInt<int64_t>(payload + sizeof(uint32_t));
+            fileHash.hash = readInt<uint64_t>(payload + sizeof(uint32_t) + sizeof(int64_t));
+            m_records++;
+        } else if (type == InputsHashRecord || type == CommandHashRecord || type == InterfaceHashRecord) {
+            // The output id and the hash of its inputs, of the command that built it or of its interface.
+            if (size != sizeof(uint32_t) + sizeof(uint64_t))
+                break;
+            const unsigned id = readInt<uint32_t>(payload);
+            if (id >= m_paths.size())
+                break;
+            HashMap& hashes = type == InputsHashRecord ? m_inputsHashes : type == CommandHashRecord ? m_commandHashes : m_interfaceHashes;
+            hashes[id] = readInt<uint64_t>(payload + sizeof(uint32_t));
+            m_records++;
+        } else {
+            break;
+        }
+        pos += sizeof(uint32_t) + size;
+    }
+
+    // A build interrupted while writing can leave a truncated record at the end, just drop it.
+    if (pos != data.size()) {
+        Debug() << "Dependency log " << m_fileName << " truncated at " << pos << " bytes.";
+        if (truncate(m_fileName.c_str(), pos))
+            return false;
+    }
+
+    m_file.open(m_fileName.c_str(), std::ios::binary | std::ios::out | std::ios::app);
+    return m_file.good();
+}
+
+void DepsLog::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file.is_open())
+        return;
+    m_file.close();
+    if (shouldCompact())
+        compact();
+}
+
+bool DepsLog::dependencies(const std::string& output, long long outputTime, std::vector<const std::string*>& deps) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto pathIt = m_pathIds.find(output);
+    if (pathIt == m_pathIds.end())
+        return false;
+    auto depsIt = m_deps.find(pathIt->second);
+    if (depsIt == m_deps.end() || depsIt->second.outputTime != outputTime)
+        return false;
+
+    deps.clear();
+    deps.reserve(depsIt->second.ids.size());
+    for (unsigned id : depsIt->second.ids)
+        deps.push_back(&m_paths[id]);
+    return true;
+}
+
+void DepsLog::recordDependencies(const std::string& output, long long outputTime, const StringList& deps)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Deps entry;
+    entry.outputTime = outputTime;
+    for (const std::string& dep : deps)
+        entry.ids.push_back(pathId(dep));
+    const unsigned outputId = pathId(output);
+
+    auto it = m_deps.find(outputId);
+    if (it != m_deps.end() && it->second.outputTime == entry.outputTime && it->second.ids == entry.ids)
+        return;
+    writeDeps(outputId, entry);
+    m_deps[outputId] = std::move(entry);
+}
+
+bool DepsLog::ingestDepFile(const std::string& output, long long outputTime, const std::string& depFile)
+{
+    std::ifstream file(depFile.c_str());
+    if (!file)
+        return false;
+    std::ostringstream content;
+    content << file.rdbuf();
+    const std::string data = content.str();
+
+    // Format: "output: dep1 dep2 \<newline> dep3", spaces in file names are escaped with a backslash.
+    size_t pos = data.find(": ");
+    if (pos == std::string::npos)
+        return false;
+
+    StringList deps;
+    std::string dep;
+    for (pos += 2; pos < data.size(); ++pos) {
+        const char c = data[pos];
+        if (c == '\\' && pos + 1 < data.size()) {
+            const char next = data[pos + 1];
+            if (next == ' ') {
+                dep += ' ';
+                ++pos;
+                continue;
+            } else if (next == '\n' || next == '\r') {
+                ++pos;
+                continue;
+            }
+        }
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            if (!dep.empty())
+                deps.push_back(dep);
+            dep.clear();
+            // Phony targets for headers may follow the first rule, stop there.
+            if (c == '\n' && pos + 1 < data.size() && data[pos + 1] == '\n')
+                break;
+        } else {
+            dep += c;
+        }
+    }
+    if (!dep.empty())
+        deps.push_back(dep);
+
+    recordDependencies(output, outputTime, deps);
+    return true;
+}
+
+uint64_t DepsLog::fileHash(const std::string& fileName)
+{
+    const long long modificationTime = OS::modificationTime(fileName);
+    if (!modificationTime)
+        return 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto pathIt = m_pathIds.find(fileName);
+        if (pathIt != m_pathIds.end()) {
+            auto it = m_fileHashes.find(pathIt->second);
+            if (it != m_fileHashes.end() && it->second.modificationTime == modificationTime)
+                return it->second.hash;
+        }
+    }
+
+    // Read the file without holding the lock, other threads may be asking for other files.
+    FileHash fileHash;
+    fileHash.modificationTime = modificationTime;
+    fileHash.hash = hashFile(fileName);
+    if (!fileHash.hash)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const unsigned id = pathId(fileName);
+    writeFileHash(id, fileHash);
+    m_fileHashes[id] = fileHash;
+    return fileHash.hash;
+}
+
+uint64_t DepsLog::inputsHash(const std::vector<const std::string*>& inputs)
+{
+    uint64_t hash = inputs.size();
+    for (const std::string* input : inputs) {
+        const uint64_t contentHash = fileHash(*input);
+        hash = hashString(*input, hash);
+        hash = hashData(&contentHash, sizeof(contentHash), hash);
+    }
+    return hash;
+}
+
+uint64_t DepsLog::recordedInputsHash(const std::string& output) const
+{
+    return recordedHash(m_inputsHashes, output);
+}
+
+void DepsLog::recordInputsHash(const std::string& output, uint64_t hash)
+{
+    recordHash(InputsHashRecord, m_inputsHashes, output, hash);
+}
+
+uint64_t DepsLog::commandHash(const StringList& command)
+{
+    uint64_t hash = command.size();
+    for (const std::string& arg : command)
+        hash = hashString(arg, hash);
+    return hash;
+}
+
+uint64_t DepsLog::recordedCommandHash(const std::string& output) const
+{
+    return recordedHash(m_commandHashes, output);
+}
+
+void DepsLog::recordCommandHash(const std::string& output, uint64_t hash)
+{
+    recordHash(CommandHashRecord, m_commandHashes, output, hash);
+}
+
+uint64_t DepsLog::recordedInterfaceHash(const std::string& output) const
+{
+    return recordedHash(m_interfaceHashes, output);
+}
+
+void DepsLog::recordInterfaceHash(const std::string& output, uint64_t hash)
+{
+    recordHash(InterfaceHashRecord, m_interfaceHashes, output, hash);
+}
+
+uint64_t DepsLog::linkCommandHash(uint64_t commandHash, const StringList& libraries) const
+{
+    for (const std::string& library : libraries) {
+        const uint64_t interfaceHash = recordedInterfaceHash(library);
+        commandHash = hashData(&interfaceHash, sizeof(interfaceHash), commandHash);
+    }
+    return commandHash;
+}
+
+uint64_t DepsLog::recordedHash(const HashMap& hashes, const std::string& output) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto pathIt = m_pathIds.find(output);
+    if (pathIt == m_pathIds.end())
+        return 0;
+    auto it = hashes.find(pathIt->second);
+    return it != hashes.end() ? it->second : 0;
+}
+
+void DepsLog::recordHash(unsigned type, HashMap& hashes, const std::string& output, uint64_t hash)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const unsigned id = pathId(output);
+    auto it = hashes.find(id);
+    if (it != hashes.end() && it->second == hash)
+        return;
+    writeHash(type, id, hash);
+    hashes[id] = hash;
+}
+
+unsigned DepsLog::pathId(const std::string& path)
+{
+    auto it = m_pathIds.find(path);
+    if (it != m_pathIds.end())
+        return it->second;
+
+    const unsigned id = m_paths.size();
+    std::string payload = path;
+    payload.resize((path.size() + 4) & ~3u, '\0');
+    appendInt<uint32_t>(payload, ~id);
+    writeRecord(PathRecord, payload);
+
+    m_paths.push_back(path);
+    m_pathIds[path] = id;
+    return id;
+}
+
+void DepsLog::writeRecord(unsigned type, const std::string& payload)
+{
+    if (!m_file.is_open())
+        return;
+    if (payload.size() > MaxRecordSize)
+        throw Error("Record too big for dependency log " + m_fileName + '.');
+
+    const uint32_t header = (type << 28) | payload.size();
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.write(payload.data(), payload.size());
+    m_file.flush();
+}
+
+void DepsLog::writeDeps(unsigned outputId, const Deps& deps)
+{
+    std::string payload;
+    payload.reserve(sizeof(uint32_t) + sizeof(int64_t) + deps.ids.size() * sizeof(uint32_t));
+    appendInt<uint32_t>(payload, outputId);
+    appendInt<int64_t>(payload, deps.outputTime);
+    for (unsigned id : deps.ids)
+        appendInt<uint32_t>(payload, id);
+    writeRecord(DepsRecord, payload);
+    m_records++;
+}
+
+void DepsLog::writeFileHash(unsigned id, const FileHash& fileHash)
+{
+    std::string payload;
+    appendInt<uint32_t>(payload, id);
+    appendInt<int64_t>(payload, fileHash.modificationTime);
+    appendInt<uint64_t>(payload, fileHash.hash);
+    writeRecord(FileHashRecord, payload);
+    m_records++;
+}
+
+void DepsLog::writeHash(unsigned type, unsigned outputId, uint64_t hash)
+{
+    std::string payload;
+    appendInt<uint32_t>(payload, outputId);
+    appendInt<uint64_t>(payload, hash);
+    writeRecord(type, payload);
+    m_records++;
+}
+
+bool DepsLog::shouldCompact() const
+{
+    // Like ninja, only bother when there's a lot of outdated records.
+    const size_t liveRecords = m_deps.size() + m_fileHashes.size() + m_inputsHashes.size() + m_commandHashes.size()
+                              + m_interfaceHashes.size();
+    return m_records > 1000 && m_records > 3 * liveRecords;
+}
+
+void DepsLog::compact()
+{
+    Debug() << "Compacting dependency log " << m_fileName;
+
+    std::deque<std::string> oldPaths;
+    std::unordered_map<unsigned, Deps> oldDeps;
+    std::unordered_map<unsigned, FileHash> oldFileHashes;
+    HashMap oldInputsHashes;
+    HashMap oldCommandHashes;
+    HashMap oldInterfaceHashes;
+    oldPaths.swap(m_paths);
+    oldDeps.swap(m_deps);
+    oldFileHashes.swap(m_fileHashes);
+    oldInputsHashes.swap(m_inputsHashes);
+    oldCommandHashes.swap(m_commandHashes);
+    oldInterfaceHashes.swap(m_interfaceHashes);
+    m_pathIds.clear();
+    m_records = 0;
+
+    const std::string tmpFileName = m_fileName + ".tmp";
+    m_file.open(tmpFileName.c_str(), std::ios::binary | std::ios::out | std::ios::trunc);
+    m_file.write(Magic, sizeof(Magic) - 1);
+    m_file.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+    for (auto& pair : oldDeps) {
+        Deps deps;
+        deps.outputTime = pair.second.outputTime;
+        for (unsigned id : pair.second.ids)
+            deps.ids.push_back(pathId(oldPaths[id]));
+        const unsigned outputId = pathId(oldPaths[pair.first]);
+        writeDeps(outputId, deps);
+        m_deps[outputId] = std::move(deps);
+    }
+    for (auto& pair : oldFileHashes) {
+        const unsigned id = pathId(oldPaths[pair.first]);
+        writeFileHash(id, pair.second);
+        m_fileHashes[id] = pair.second;
+    }
+    for (auto& pair : oldInputsHashes) {
+        const unsigned id = pathId(oldPaths[pair.first]);
+        writeHash(InputsHashRecord, id, pair.second);
+        m_inputsHashes[id] = pair.second;
+    }
+    for (auto& pair : oldCommandHashes) {
+        const unsigned id = pathId(oldPaths[pair.first]);
+        writeHash(CommandHashRecord, id, pair.second);
+        m_commandHashes[id] = pair.second;
+    }
+    for (auto& pair : oldInterfaceHashes) {
+        const unsigned id = pathId(oldPaths[pair.first]);
+        writeHash(InterfaceHashRecord, id, pair.second);
+        m_interfaceHashes[id] = pair.second;
+    }
+    const bool ok = m_file.good();
+    m_file.close();
+
+    if (!ok || std::rename(tmpFileName.c_str(), m_fileName.c_str())) {
+        Warn() << "Unable to compact dependency log " << m_fileName << '.';
+        OS::rm(tmpFileName);
+    }
+}
@@ -0,0 +1,131 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEPSLOG_H
+#define DEPSLOG_H
+
+#include "basictypes.h"
+#include <stdint.h>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Append only binary log with the dependencies of each object file, like ninja's .ninja_deps.
+ *
+ * The dependencies written by the compiler are ingested once after each compilation, so up-to-date
+ * checks don't need to parse the compiler dependency files again on every build.
+ *
+ * The file is a sequence of records, each one starting with a 32 bits header with the record type
+ * in the 4 upper bits and the payload size in the remaining bits. Paths are interned, a path record
+ * gives the next id to a path and other records refer to paths by their ids. The log is compacted
+ * when closed if it has too many outdated records.
+ *
+ * Besides the dependencies, the log also keeps the content hash of files, with the modification
+ * time they had when hashed, and the hash of the inputs of each output when it was built. These
+ * are used by the --hash-inputs mode. The hash of the command line that built each output is kept
+ * too, so only the outputs whose own command changed are built again, and the hash of the
+ * interface exported by each shared library, so its users are only relinked when it changes.
+ *
+ * All methods are thread safe.
+ */
+class DepsLog
+{
+public:
+    DepsLog();
+    ~DepsLog();
+
+    /// Load the log from \p fileName, creating it if needed, and keep it open to append new records.
+    void open(const std::string& fileName);
+    /// Close the log, compacting it if it's worth.
+    void close();
+
+    /**
+     * Get the dependencies recorded for \p output.
+     *
+     * Returns false if there's none or if they were recorded when \p output had a modification
+     * time other than \p outputTime, i.e. it was built by someone else.
+     */
+    bool dependencies(const std::string& output, long long outputTime, std::vector<const std::string*>& deps) const;
+    /// Record \p deps as the dependencies of \p output, with modification time \p outputTime.
+    void recordDependencies(const std::string& output, long long outputTime, const StringList& deps);
+    /// Parse the makefile rule written by the compiler in \p depFile and record it, returns false on errors.
+    bool ingestDepFile(const std::string& output, long long outputTime, const std::string& depFile);
+
+    /// Hash of the contents of \p fileName, only read again if the file modification time changed, 0 if it doesn't exist.
+    uint64_t fileHash(const std::string& fileName);
+    /// Combined hash of the contents of all \p inputs.
+    uint64_t inputsHash(const std::vector<const std::string*>& inputs);
+    /// Hash of the inputs used to build \p output the last time, 0 if unknown.
+    uint64_t recordedInputsHash(const std::string& output) const;
+    void recordInputsHash(const std::string& output, uint64_t hash);
+
+    /// Hash of the command line \p command.
+    static uint64_t commandHash(const StringList& command);
+    /// Hash of the command used to build \p output the last time, 0 if unknown.
+    uint64_t recordedCommandHash(const std::string& output) const;
+    void recordCommandHash(const std::string& output, uint64_t hash);
+
+    /// Hash of the interface exported by the shared library \p output when it was last built, 0 if unknown.
+    uint64_t recordedInterfaceHash(const std::string& output) const;
+    void recordInterfaceHash(const std::string& output, uint64_t hash);
+    /// Hash of a link \p command with the recorded interface hashes of the shared \p libraries it uses.
+    uint64_t linkCommandHash(uint64_t commandHash, const StringList& libraries) const;
+
+    DepsLog(const DepsLog&) = delete;
+    DepsLog& operator=(const DepsLog&) = delete;
+private:
+    struct Deps {
+        long long outputTime;
+        std::vector<unsigned> ids;
+    };
+    typedef std::unordered_map<unsigned, uint64_t> HashMap;
+    struct FileHash {
+        long long modificationTime;
+        uint64_t hash;
+    };
+
+    std::string m_fileName;
+    std::ofstream m_file;
+    mutable std::mutex m_mutex;
+
+    // Using a deque the path addresses don't change when new paths are added.
+    std::deque<std::string> m_paths;
+    std::unordered_map<std::string, unsigned> m_pathIds;
+    std::unordered_map<unsigned, Deps> m_deps;
+    std::unordered_map<unsigned, FileHash> m_fileHashes;
+    HashMap m_inputsHashes;
+    HashMap m_commandHashes;
+    HashMap m_interfaceHashes;
+    // Number of records that may be outdated by newer ones.
+    unsigned m_records;
+
+    bool load();
+    unsigned pathId(const std::string& path);
+    void writeRecord(unsigned type, const std::string& payload);
+    void writeDeps(unsigned outputId, const Deps& deps);
+    void writeFileHash(unsigned id, const FileHash& fileHash);
+    void writeHash(unsigned type, unsigned outputId, uint64_t hash);
+    uint64_t recordedHash(const HashMap& hashes, const std::string& output) const;
+    void recordHash(unsigned type, HashMap& hashes, const std::string& output, uint64_t hash);
+    bool shouldCompact() const;
+    void compact();
+};
+
+#endif
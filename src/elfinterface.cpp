@@ -0,0 +1,274 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "elfinterface.h"
+#include "filehash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace {
+
+// Bit of a .gnu.version entry set for non default versions, i.e. symbol@VERSION instead of symbol@@VERSION.
+const uint16_t VersionHidden = 0x8000;
+
+struct Elf32 {
+    typedef Elf32_Ehdr Ehdr;
+    typedef Elf32_Shdr Shdr;
+    typedef Elf32_Sym Sym;
+    typedef Elf32_Dyn Dyn;
+    typedef Elf32_Versym Versym;
+    typedef Elf32_Verdef Verdef;
+    typedef Elf32_Verdaux Verdaux;
+    static unsigned char bind(unsigned char info) { return ELF32_ST_BIND(info); }
+    static unsigned char type(unsigned char info) { return ELF32_ST_TYPE(info); }
+    static unsigned char visibility(unsigned char other) { return ELF32_ST_VISIBILITY(other); }
+};
+
+struct Elf64 {
+    typedef Elf64_Ehdr Ehdr;
+    typedef Elf64_Shdr Shdr;
+    typedef Elf64_Sym Sym;
+    typedef Elf64_Dyn Dyn;
+    typedef Elf64_Versym Versym;
+    typedef Elf64_Verdef Verdef;
+    typedef Elf64_Verdaux Verdaux;
+    static unsigned char bind(unsigned char info) { return ELF64_ST_BIND(info); }
+    static unsigned char type(unsigned char info) { return ELF64_ST_TYPE(info); }
+    static unsigned char visibility(unsigned char other) { return ELF64_ST_VISIBILITY(other); }
+};
+
+// Only the headers and the few sections describing the interface are read, not the whole library.
+class ElfFile
+{
+public:
+    explicit ElfFile(const std::string& fileName)
+        : m_fd(open(fileName.c_str(), O_RDONLY | O_CLOEXEC))
+        , m_size(0)
+    {
+        struct stat st;
+        if (m_fd != -1 && !fstat(m_fd, &st))
+            m_size = st.st_size;
+    }
+    ~ElfFile()
+    {
+        if (m_fd != -1)
+            close(m_fd);
+    }
+
+    bool read(uint64_t offset, void* data, size_t size) const
+    {
+        if (offset > m_size || m_size - offset < size)
+            return false;
+        char* buffer = static_cast<char*>(data);
+        while (size) {
+            ssize_t bytes = pread(m_fd, buffer, size, offset);
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+                return false;
+            buffer += bytes;
+            offset += bytes;
+            size -= bytes;
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool read(uint64_t offset, T& value) const { return read(offset, &value, sizeof(T)); }
+
+    template<typename Shdr>
+    bool readSection(const Shdr& section, std::string& data) const
+    {
+        if (section.sh_type == SHT_NOBITS || section.sh_size > m_size)
+            return false;
+        data.resize(section.sh_size);
+        return read(section.sh_offset, &data[0], data.size());
+    }
+
+    ElfFile(const ElfFile&) = delete;
+    ElfFile& operator=(const ElfFile&) = delete;
+private:
+    int m_fd;
+    uint64_t m_size;
+};
+
+template<typename T>
+bool get(const std::string& data, size_t offset, T& value)
+{
+    if (offset > data.size() || data.size() - offset < sizeof(T))
+        return false;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return true;
+}
+
+// Null terminated string at \p offset of the string table \p strtab.
+bool getString(const std::string& strtab, size_t offset, std::string& str)
+{
+    if (offset >= strtab.size())
+        return false;
+    const char* begin = strtab.data() + offset;
+    str.assign(begin, strnlen(begin, strtab.size() - offset));
+    return true;
+}
+
+template<typename Elf>
+uint64_t hashInterface(const ElfFile& file)
+{
+    typedef typename Elf::Shdr Shdr;
+
+    typename Elf::Ehdr header;
+    if (!file.read(0, header) || header.e_type != ET_DYN || header.e_shentsize != sizeof(Shdr))
+        return 0;
+
+    std::vector<Shdr> sections(header.e_shnum);
+    if (sections.empty() || !file.read(header.e_shoff, sections.data(), sections.size() * sizeof(Shdr)))
+        return 0;
+
+    const Shdr* dynsym = nullptr;
+    const Shdr* dynamic = nullptr;
+    const Shdr* versym = nullptr;
+    const Shdr* verdef = nullptr;
+    for (const Shdr& section : sections) {
+        const Shdr** found = section.sh_type == SHT_DYNSYM ? &dynsym
+                           : section.sh_type == SHT_DYNAMIC ? &dynamic
+                           : section.sh_type == SHT_GNU_versym ? &versym
+                           : section.sh_type == SHT_GNU_verdef ? &verdef : nullptr;
+        if (found && !*found)
+            *found = &section;
+    }
+
+    // The section and the string table it refers to.
+    auto readWithStrings = [&](const Shdr& section, std::string& data, std::string& strtab) {
+        return section.sh_link < sections.size() && file.readSection(section, data)
+               && file.readSection(sections[section.sh_link], strtab);
+    };
+
+    std::vector<std::string> entries;
+    std::string data;
+    std::string strtab;
+    if (dynamic) {
+        if (!readWithStrings(*dynamic, data, strtab))
+            return 0;
+        typename Elf::Dyn dyn;
+        for (size_t pos = 0; get(data, pos, dyn) && dyn.d_tag != DT_NULL; pos += sizeof(dyn)) {
+            std::string soname;
+            if (dyn.d_tag == DT_SONAME && getString(strtab, dyn.d_un.d_val, soname))
+                entries.push_back("soname " + soname);
+        }
+    }
+
+    // Names of the versions defined by the library, by version index.
+    std::vector<std::string> versionNames;
+    if (verdef) {
+        if (!readWithStrings(*verdef, data, strtab))
+            return 0;
+        size_t pos = 0;
+        for (unsigned i = 0; i < verdef->sh_info; ++i) {
+            typename Elf::Verdef def;
+            typename Elf::Verdaux aux;
+            std::string name;
+            if (!get(data, pos, def) || !get(data, pos + def.vd_aux, aux) || !getString(strtab, aux.vda_name, name))
+                return 0;
+            if (def.vd_ndx >= versionNames.size())
+                versionNames.resize(def.vd_ndx + 1);
+            versionNames[def.vd_ndx] = name;
+            if (!def.vd_next)
+                break;
+            pos += def.vd_next;
+        }
+    }
+
+    std::string versions;
+    if (versym && !file.readSection(*versym, versions))
+        return 0;
+
+    if (dynsym) {
+        if (!readWithStrings(*dynsym, data, strtab))
+            return 0;
+        // The first symbol is always the undefined one.
+        typename Elf::Sym sym;
+        for (size_t i = 1; get(data, i * sizeof(sym), sym); ++i) {
+            const unsigned char bind = Elf::bind(sym.st_info);
+            const unsigned char visibility = Elf::visibility(sym.st_other);
+            if (sym.st_shndx == SHN_UNDEF || bind == STB_LOCAL || visibility == STV_HIDDEN || visibility == STV_INTERNAL)
+                continue;
+
+            std::string entry;
+            if (!getString(strtab, sym.st_name, entry))
+                return 0;
+            // Symbol versions are resolved by the dynamic linker, so they are part of the interface too.
+            typename Elf::Versym version;
+            if (get(versions, i * sizeof(version), version)) {
+                const unsigned index = version & ~VersionHidden;
+                if (index < versionNames.size() && !versionNames[index].empty())
+                    entry += ((version & VersionHidden) ? "@" : "@@") + versionNames[index];
+            }
+            const unsigned char type = Elf::type(sym.st_info);
+            entry += ' ' + std::to_string(unsigned(type)) + ' ' + std::to_string(unsigned(bind));
+            // Users of data symbols may have copy relocations, so their size is part of the interface.
+            if (type == STT_OBJECT || type == STT_TLS)
+                entry += ' ' + std::to_string(uint64_t(sym.st_size));
+            entries.push_back(entry);
+        }
+    }
+
+    // The symbol order may change from one link to another.
+    std::sort(entries.begin(), entries.end());
+    uint64_t hash = entries.size() + 1;
+    for (const std::string& entry : entries)
+        hash = hashString(entry, hash);
+    return hash;
+}
+
+}
+
+uint64_t hashElfInterface(const std::string& fileName)
+{
+    ElfFile file(fileName);
+    unsigned char ident[EI_NIDENT];
+    if (!file.read(0, ident) || std::memcmp(ident, ELFMAG, SELFMAG))
+        return 0;
+
+    // Only the native byte order is supported, it's what the compiler produces anyway.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (ident[EI_DATA] != ELFDATA2LSB)
+        return 0;
+#else
+    if (ident[EI_DATA] != ELFDATA2MSB)
+        return 0;
+#endif
+
+    switch (ident[EI_CLASS]) {
+        case ELFCLASS32:
+            return hashInterface<Elf32>(file);
+        case ELFCLASS64:
+            return hashInterface<Elf64>(file);
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,34 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ELFINTERFACE_H
+#define ELFINTERFACE_H
+
+#include <string>
+#include <stdint.h>
+
+/**
+ * Hash of the interface exported by the ELF shared library \p fileName, i.e. its soname and the
+ * defined global symbols of its dynamic symbol table, with their versions, types and the size of data
+ * symbols. Only the section headers and the dynamic sections are read.
+ *
+ * Returns 0 if the file can't be read or isn't an ELF shared object.
+ */
+uint64_t hashElfInterface(const std::string& fileName);
+
+#endif
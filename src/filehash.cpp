@@ -0,0 +1,74 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filehash.h"
+
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+uint64_t hashData(const void* data, size_t size, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+
+    uint64_t h = seed ^ (size * m);
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + (size / 8) * 8;
+    for (; bytes != end; bytes += 8) {
+        uint64_t k;
+        std::memcpy(&k, bytes, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const size_t tail = size & 7;
+    if (tail) {
+        for (size_t i = 0; i < tail; ++i)
+            h ^= uint64_t(bytes[i]) << (8 * i);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+uint64_t hashFile(const std::string& fileName)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+
+    // Each chunk is hashed using the hash of the previous ones as seed.
+    char buffer[64 * 1024];
+    uint64_t hash = 0x6d656971756521ull;
+    ssize_t bytes;
+    while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0)
+        hash = hashData(buffer, bytes, hash);
+    ::close(fd);
+    return bytes == 0 ? hash : 0;
+}
@@ -0,0 +1,31 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILEHASH_H
+#define FILEHASH_H
+
+#include <string>
+#include <stdint.h>
+
+/// Fast non cryptographic 64 bits hash of \p size bytes of \p data, based on MurmurHash64A.
+uint64_t hashData(const void* data, size_t size, uint64_t seed = 0);
+inline uint64_t hashString(const std::string& str, uint64_t seed = 0) { return hashData(str.data(), str.size(), seed); }
+/// Hash of the contents of \p fileName, 0 if the file can't be read.
+uint64_t hashFile(const std::string& fileName);
+
+#endif
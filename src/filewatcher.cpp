@@ -0,0 +1,112 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filewatcher.h"
+#include "logger.h"
+#include "os.h"
+
+extern "C" {
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+}
+
+// Time to wait for more changes after the first one, editors and version control tools touch several files at once.
+static const int GroupingTimeout = 100;
+
+FileWatcher::FileWatcher()
+{
+    m_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (m_fd == -1)
+        throw Error("Unable to watch files for changes.");
+}
+
+FileWatcher::~FileWatcher()
+{
+    close(m_fd);
+}
+
+bool FileWatcher::addFile(const std::string& fileName)
+{
+    if (!m_files.insert(fileName).second)
+        return false;
+
+    const std::string dir = OS::dirName(fileName);
+    if (m_watchedDirectories.count(dir))
+        return true;
+
+    const int wd = inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+    if (wd == -1) {
+        Warn() << "Unable to watch " << dir << " for changes.";
+        return true;
+    }
+    m_watchedDirectories.insert(dir);
+    m_directories[wd] = dir;
+    return true;
+}
+
+bool FileWatcher::readEvents(int timeout, StringSet& changedFiles)
+{
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    int res = poll(&pfd, 1, timeout);
+    if (res == -1 && errno != EINTR)
+        throw Error("Error waiting for file changes.");
+    if (res <= 0)
+        return false;
+
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(inotify_event))));
+    while (true) {
+        const ssize_t size = read(m_fd, buffer, sizeof(buffer));
+        if (size <= 0)
+            break;
+        for (char* ptr = buffer; ptr < buffer + size; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len) {
+            const inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+            // Too many events, anything may have changed.
+            if (event->mask & IN_Q_OVERFLOW) {
+                changedFiles.insert(m_files.begin(), m_files.end());
+                continue;
+            }
+            auto it = m_directories.find(event->wd);
+            if (it == m_directories.end() || !event->len)
+                continue;
+            const std::string fileName = it->second + event->name;
+            if (m_files.count(fileName))
+                changedFiles.insert(fileName);
+        }
+    }
+    return true;
+}
+
+StringList FileWatcher::waitForChanges()
+{
+    StringSet changedFiles;
+    while (changedFiles.empty())
+        readEvents(-1, changedFiles);
+    while (readEvents(GroupingTimeout, changedFiles));
+    return StringList(changedFiles.begin(), changedFiles.end());
+}
+
+StringList FileWatcher::pendingChanges()
+{
+    StringSet changedFiles;
+    readEvents(0, changedFiles);
+    return StringList(changedFiles.begin(), changedFiles.end());
+}
@@ -0,0 +1,59 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include "basictypes.h"
+#include <unordered_map>
+
+/**
+ * Watch files for changes using inotify.
+ *
+ * The directories of the files are watched instead of the files themselves, so files replaced
+ * by editors saving to a temporary file and renaming it are still noticed.
+ */
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    /**
+     * Watch \p fileName, an absolute path. Files that don't exist yet can be watched if their directory exists.
+     * Returns false if the file was already watched.
+     */
+    bool addFile(const std::string& fileName);
+    /// Block until some watched file changes and return the changed files, changes close in time are grouped together.
+    StringList waitForChanges();
+    /// The watched files changed since the last call, without blocking.
+    StringList pendingChanges();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+private:
+    int m_fd;
+    // Watch descriptor to directory name, with a trailing slash.
+    std::unordered_map<int, std::string> m_directories;
+    StringSet m_watchedDirectories;
+    StringSet m_files;
+
+    bool readEvents(int timeout, StringSet& changedFiles);
+};
+
+#endif
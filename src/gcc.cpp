@@ -17,6 +17,7 @@
 */
 
 #include "gcc.h"
+#include "depslog.h"
 #include "compileroptions.h"
 #include "linkeroptions.h"
 #include "logger.h"
@@ -49,100 +50,151 @@ CompilerFactory Gcc::factory()
     return std::move(f);
 }
 
-bool Gcc::shouldCompile(const std::string& source, const std::string& output) const
+bool Gcc::shouldCompile(const std::string& source, const std::string& output, DepsLog& depsLog) const
 {
     if (OS::timestampCompare(source, output) < 0)
         return true;
 
-    std::ifstream f((output + ".d").c_str());
-    if (!f)
-        return true;
+    // The .d file is only parsed if the object wasn't compiled by us, e.g. the log was removed.
+    std::vector<const std::string*> deps;
+    if (!depsLog.dependencies(output, OS::modificationTime(output), deps)) {
+        if (!ingestDependencies(output, depsLog) || !depsLog.dependencies(output, OS::modificationTime(output), deps))
+            return true;
+    }
 
-    std::string line;
-    std::getline(f, line);
-    stringReplace(line, output + ": ", "");
+    for (const std::string* dep : deps) {
+        if (OS::timestampCompare(*dep, output) < 0)
+            return true;
+    }
+    return false;
+}
 
-    do {
-        if (line.length() > 2) {
-            if (*line.rbegin() == '\\')
-            line.erase(line.length()-2);
+bool Gcc::ingestDependencies(const std::string& output, DepsLog& depsLog) const
+{
+    return depsLog.ingestDepFile(output, OS::modificationTime(output), output + ".d");
+}
 
-            StringList deps = split(line, ' ');
-            for (const std::string& dep : deps) {
-                if (OS::timestampCompare(dep, output) < 0)
-                    return true;
-            }
-        }
-        std::getline(f, line);
-        trim(line);
-    } while (f);
-    return false;
+// Returns true if some item in \p args starts with \p flag.
+static bool hasFlag(const StringList& args, const char* flag)
+{
+    return std::any_of(args.begin(), args.end(), [flag](const std::string& arg) { return arg.find(flag) == 0; });
 }
 
-std::string Gcc::compile(const std::string& fileName, const std::string& output, const CompilerOptions* options)
+// Custom flags are free text written by the user, split them into arguments.
+static void appendCustomFlags(StringList& args, const StringList& flags)
 {
-    CompilerCommandCache::const_iterator it = m_compileCommandCache.find(options);
-    if (it != m_compileCommandCache.end()) {
-        std::string cachedCmd = it->second;
-        cachedCmd += " -MMD -MF ";
-        cachedCmd += output + ".d";
-        cachedCmd += " -c ";
-        cachedCmd += fileName;
-        cachedCmd += " -o ";
-        cachedCmd += output;
-        return std::move(cachedCmd);
+    for (const std::string& flag : flags) {
+        for (const std::string& piece : split(flag))
+            args.push_back(OS::shellText(piece));
     }
+}
 
-    std::string command;
-    Language lang = identifyLanguage(fileName);
-    if (lang == CLanguage)
-        command += "gcc";
-    else if (lang == CPlusPlusLanguage)
-        command += "g++";
-    else
-        throw Error("Unknown programming language used for " + fileName);
+const StringList& Gcc::compileFlags(const CompilerOptions* options)
+{
+    CompilerCommandCache::const_iterator it = m_compileCommandCache.find(options);
+    if (it != m_compileCommandCache.end())
+        return it->second;
+
+    StringList args;
 
     // custom flags
-    command += " " + join(options->customFlags(), " ");
+    appendCustomFlags(args, options->customFlags());
 
     // include paths
     for (const std::string& path : options->includePaths())
-        command += " -I\"" + path + '"';
+        args.push_back("-I" + path);
 
     // defines
     for (const std::string& path : options->defines())
-        command += " -D" + path;
+        args.push_back("-D" + path);
+
+    // path prefix maps, for debug info, __FILE__ and friends
+    for (const std::string& map : options->pathPrefixMaps())
+        args.push_back("-ffile-prefix-map=" + map);
 
     // Extra arguments
     if (options->compileForLibrary()) {
-        if (!contains(command, " -fPIC") && !contains(command, " -fpic"))
-            command += " -fPIC";
-        command += " -fvisibility=hidden";
+        if (!contains(args, "-fPIC") && !contains(args, "-fpic"))
+            args.push_back("-fPIC");
+        args.push_back("-fvisibility=hidden");
     }
     if (options->debugInfoEnabled()) {
-        if (!contains(command, " -g") && !contains(command, " -ggdb"))
-            command += " -ggdb";
+        if (!hasFlag(args, "-g"))
+            args.push_back("-ggdb");
     }
 
-    if (!contains(command, " -W"))
-        command += " -Wall";
+    if (!hasFlag(args, "-W"))
+        args.push_back("-Wall");
 
-    m_compileCommandCache[options] = command;
-    return compile(fileName, output, options);
+    return m_compileCommandCache[options] = args;
+}
+
+StringList Gcc::compile(const std::string& fileName, const std::string& output, const CompilerOptions* options)
+{
+    StringList args;
+    Language lang = identifyLanguage(fileName);
+    if (lang == CLanguage)
+        args.push_back("gcc");
+    else if (lang == CPlusPlusLanguage)
+        args.push_back("g++");
+    else
+        throw Error("Unknown programming language used for " + fileName);
+
+    const StringList& flags = compileFlags(options);
+    args.insert(args.end(), flags.begin(), flags.end());
+
+    // GCC uses the .gch found beside the included file, or the file itself if the .gch doesn't fit.
+    const std::string pch = options->precompiledHeader();
+    if (lang == CPlusPlusLanguage && !pch.empty()) {
+        args.push_back("-Winvalid-pch");
+        args.push_back("-fpch-deps");
+        args.push_back("-include");
+        args.push_back(pch.substr(0, pch.size() - 4));
+    }
+
+    // System headers are dependencies too, they may change with a library upgrade and are often most of what is parsed.
+    args.push_back("-MD");
+    args.push_back("-MF");
+    args.push_back(output + ".d");
+    args.push_back("-c");
+    args.push_back(fileName);
+    args.push_back("-o");
+    args.push_back(output);
+    return args;
+}
+
+StringList Gcc::precompileHeader(const std::string& header, const std::string& output, const CompilerOptions* options)
+{
+    StringList args;
+    args.push_back("g++");
+    const StringList& flags = compileFlags(options);
+    args.insert(args.end(), flags.begin(), flags.end());
+    args.push_back("-x");
+    args.push_back("c++-header");
+    args.push_back("-MD");
+    args.push_back("-MF");
+    args.push_back(output + ".d");
+    args.push_back("-c");
+    args.push_back(header);
+    args.push_back("-o");
+    args.push_back(output);
+    return args;
 }
 
-std::string Gcc::link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const
+StringList Gcc::link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const
 {
     StringList args;
-    std::string command;
+    StringList command;
 
     if (options->linkType() == LinkerOptions::StaticLibrary) {
-        command = "ar -rcs " + output;
+        command.push_back("ar");
+        command.push_back("-rcs");
+        command.push_back(output);
     } else {
         if (options->language() == CPlusPlusLanguage)
-            command = "g++";
+            command.push_back("g++");
         else if (options->language() == CLanguage)
-            command = "gcc";
+            command.push_back("gcc");
         else
             throw Error("Unsupported programming language sent to the linker!");
 
@@ -150,8 +202,7 @@ std::string Gcc::link(const std::string& output, const StringList& objects, cons
         args.push_back(output);
 
         // custom flags
-        StringList flags = options->customFlags();
-        std::copy(flags.begin(), flags.end(), std::back_inserter(args));
+        appendCustomFlags(args, options->customFlags());
 
         if (options->linkType() == LinkerOptions::SharedLibrary) {
             if (!contains(args, "-fPIC") && !contains(args, "-fpic"))
@@ -164,7 +215,7 @@ std::string Gcc::link(const std::string& output, const StringList& objects, cons
         StringList paths = options->libraryPaths();
         StringList::iterator it = paths.begin();
         for (; it != paths.end(); ++it)
-            args.push_back("-L\"" + *it + '"');
+            args.push_back("-L" + *it);
 
         // libraries
         StringList libraries = options->libraries();
@@ -181,19 +232,17 @@ std::string Gcc::link(const std::string& output, const StringList& objects, cons
             args.push_back("-Wl,-rpath=" + join(paths, ":"));
     }
 
-    command += ' ';
     const std::string objectsStr = join(objects, " ");
 
     // The arg limit is about 16K on Linux
     if (objectsStr.size() > 10000) {
         std::ofstream args(targetDirectory + output + ".meiqueobjectlist", std::ios::out | std::ios::trunc);
         args << objectsStr;
-        command += '@' + output + ".meiqueobjectlist";
+        command.push_back('@' + output + ".meiqueobjectlist");
     } else {
-        command.append(objectsStr);
+        std::copy(objects.begin(), objects.end(), std::back_inserter(command));
     }
-    command += ' ';
-    command += join(args, " ");
+    std::copy(args.begin(), args.end(), std::back_inserter(command));
 
     return command;
 }
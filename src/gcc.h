@@ -26,14 +26,19 @@ class Gcc : public Compiler
 public:
     static CompilerFactory factory();
 
-    std::string compile(const std::string& fileName, const std::string& output, const CompilerOptions* options);
-    std::string link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const;
+    StringList compile(const std::string& fileName, const std::string& output, const CompilerOptions* options);
+    StringList precompileHeader(const std::string& header, const std::string& output, const CompilerOptions* options);
+    StringList link(const std::string& output, const StringList& objects, const LinkerOptions* options, const std::string& targetDirectory) const;
     std::string nameForExecutable(const std::string& name) const;
     std::string nameForStaticLibrary(const std::string& name) const;
     std::string nameForSharedLibrary(const std::string& name) const;
-    bool shouldCompile(const std::string& source, const std::string& output) const;
+    bool shouldCompile(const std::string& source, const std::string& output, DepsLog& depsLog) const;
+    bool ingestDependencies(const std::string& output, DepsLog& depsLog) const;
 private:
-    typedef std::unordered_map<const CompilerOptions*, std::string> CompilerCommandCache;
+    /// Flags used by all compilations with \p options.
+    const StringList& compileFlags(const CompilerOptions* options);
+
+    typedef std::unordered_map<const CompilerOptions*, StringList> CompilerCommandCache;
     CompilerCommandCache m_compileCommandCache;
 };
 
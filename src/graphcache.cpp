@@ -0,0 +1,258 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "graphcache.h"
+#include "depslog.h"
+#include "logger.h"
+#include "meiqueversion.h"
+#include "os.h"
+#include "stdstringsux.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// The number after the version changes with the snapshot format.
+static const char Magic[] = "# meiquegraph " MEIQUE_VERSION " 2\n";
+
+namespace {
+
+class Writer
+{
+public:
+    void write(uint64_t value) { m_data.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void write(const std::string& str)
+    {
+        write(uint64_t(str.size()));
+        m_data += str;
+    }
+    void write(const StringList& list)
+    {
+        write(uint64_t(list.size()));
+        for (const std::string& str : list)
+            write(str);
+    }
+    const std::string& data() const { return m_data; }
+private:
+    std::string m_data;
+};
+
+// Reads values written by Writer, after any read past the end of the data all reads fail.
+class Reader
+{
+public:
+    Reader(const std::string& data, size_t pos) : m_data(data), m_pos(pos), m_ok(true) {}
+    bool ok() const { return m_ok; }
+    bool read(uint64_t& value)
+    {
+        if (!m_ok || m_pos + sizeof(value) > m_data.size())
+            return m_ok = false;
+        std::memcpy(&value, m_data.data() + m_pos, sizeof(value));
+        m_pos += sizeof(value);
+        return true;
+    }
+    bool read(long long& value)
+    {
+        uint64_t v;
+        if (!read(v))
+            return false;
+        value = v;
+        return true;
+    }
+    bool read(std::string& str)
+    {
+        uint64_t size;
+        if (!read(size) || m_pos + size > m_data.size())
+            return m_ok = false;
+        str.assign(m_data, m_pos, size);
+        m_pos += size;
+        return true;
+    }
+    bool read(StringList& list)
+    {
+        uint64_t size;
+        if (!read(size))
+            return false;
+        for (uint64_t i = 0; i < size && m_ok; ++i) {
+            list.push_back(std::string());
+            read(list.back());
+        }
+        return m_ok;
+    }
+private:
+    const std::string& m_data;
+    size_t m_pos;
+    bool m_ok;
+};
+
+}
+
+GraphCache::GraphCache(const std::string& fileName)
+    : m_fileName(fileName)
+    , m_needsLua(false)
+{
+}
+
+void GraphCache::addProjectFile(const std::string& fileName)
+{
+    m_projectFiles.push_back(std::make_pair(fileName, OS::modificationTime(fileName)));
+}
+
+void GraphCache::save(const StringList& targets)
+{
+    if (m_needsLua) {
+        remove();
+        return;
+    }
+
+    Writer writer;
+    writer.write(targets);
+    writer.write(uint64_t(m_projectFiles.size()));
+    for (const auto& projectFile : m_projectFiles) {
+        writer.write(projectFile.first);
+        writer.write(uint64_t(projectFile.second));
+    }
+    writer.write(uint64_t(m_compilations.size()));
+    for (const Compilation& compilation : m_compilations) {
+        writer.write(compilation.source);
+        writer.write(compilation.output);
+        writer.write(compilation.commandHash);
+    }
+    writer.write(uint64_t(m_links.size()));
+    for (const Link& link : m_links) {
+        writer.write(link.output);
+        writer.write(link.commandHash);
+        writer.write(link.libraries);
+    }
+    writer.write(uint64_t(m_customTargets.size()));
+    for (const CustomTarget& customTarget : m_customTargets) {
+        writer.write(customTarget.inputs);
+        writer.write(customTarget.outputs);
+    }
+
+    // Written to a temporary file first, so an interrupted build never leaves a broken snapshot behind.
+    const std::string tmpFileName = m_fileName + ".tmp";
+    std::ofstream file(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(Magic, sizeof(Magic) - 1);
+    file.write(writer.data().data(), writer.data().size());
+    file.close();
+    if (!file || std::rename(tmpFileName.c_str(), m_fileName.c_str())) {
+        Debug() << "Unable to save the build graph to " << m_fileName << '.';
+        OS::rm(tmpFileName);
+    }
+}
+
+bool GraphCache::load(const StringList& targets)
+{
+    std::ifstream file(m_fileName.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream content;
+    content << file.rdbuf();
+    const std::string data = content.str();
+    if (data.compare(0, sizeof(Magic) - 1, Magic) != 0)
+        return false;
+
+    Reader reader(data, sizeof(Magic) - 1);
+    StringList savedTargets;
+    if (!reader.read(savedTargets) || savedTargets != targets)
+        return false;
+
+    uint64_t count = 0;
+    reader.read(count);
+    for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+        std::pair<std::string, long long> projectFile;
+        reader.read(projectFile.first);
+        reader.read(projectFile.second);
+        if (OS::modificationTime(projectFile.first) != projectFile.second) {
+            Debug() << "Project file " << projectFile.first << " changed, evaluating the project.";
+            return false;
+        }
+        m_projectFiles.push_back(projectFile);
+    }
+
+    count = 0;
+    reader.read(count);
+    for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+        Compilation compilation;
+        reader.read(compilation.source);
+        reader.read(compilation.output);
+        reader.read(compilation.commandHash);
+        m_compilations.push_back(compilation);
+    }
+
+    count = 0;
+    reader.read(count);
+    for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+        Link link;
+        reader.read(link.output);
+        reader.read(link.commandHash);
+        reader.read(link.libraries);
+        m_links.push_back(link);
+    }
+
+    count = 0;
+    reader.read(count);
+    for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+        CustomTarget customTarget;
+        reader.read(customTarget.inputs);
+        reader.read(customTarget.outputs);
+        m_customTargets.push_back(customTarget);
+    }
+    return reader.ok();
+}
+
+void GraphCache::remove()
+{
+    OS::rm(m_fileName);
+}
+
+bool GraphCache::isBuildUpToDate(DepsLog& depsLog) const
+{
+    // The same checks done by the JobFactory, but without building any node.
+    for (const Compilation& compilation : m_compilations) {
+        if (depsLog.recordedCommandHash(compilation.output) != compilation.commandHash)
+            return false;
+        if (OS::timestampCompare(compilation.source, compilation.output) < 0)
+            return false;
+        std::vector<const std::string*> deps;
+        if (!depsLog.dependencies(compilation.output, OS::modificationTime(compilation.output), deps))
+            return false;
+        for (const std::string* dep : deps) {
+            if (OS::timestampCompare(*dep, compilation.output) < 0)
+                return false;
+        }
+    }
+
+    for (const Link& link : m_links) {
+        // A shared library relinked by an interrupted build changes the hash, so this link isn't up to date.
+        const uint64_t commandHash = depsLog.linkCommandHash(link.commandHash, link.libraries);
+        if (depsLog.recordedCommandHash(link.output) != commandHash || !OS::fileExists(link.output))
+            return false;
+    }
+
+    for (const CustomTarget& customTarget : m_customTargets) {
+        for (const std::string& input : customTarget.inputs) {
+            for (const std::string& output : customTarget.outputs) {
+                if (OS::timestampCompare(input, output) < 0)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GRAPHCACHE_H
+#define GRAPHCACHE_H
+
+#include "basictypes.h"
+#include <stdint.h>
+#include <vector>
+
+class DepsLog;
+
+/**
+ * Binary snapshot of what the last build needed to check, so no-op builds don't need to evaluate meique.lua.
+ *
+ * It keeps the sources, objects and command signatures of each compilation, the outputs and command
+ * signatures of each link and the inputs and outputs of each custom target, all of them for a given set
+ * of chosen targets. The snapshot is only valid while the project files keep the modification times they
+ * had when it was saved. Hooks and custom targets without outputs run on every build, so when there are
+ * any, the snapshot is marked as needing Lua and never used.
+ */
+class GraphCache
+{
+public:
+    struct Compilation {
+        std::string source;
+        std::string output;
+        uint64_t commandHash;
+    };
+    struct Link {
+        std::string output;
+        /// Hash of the link command alone, see DepsLog::linkCommandHash().
+        uint64_t commandHash;
+        StringList libraries;
+    };
+    struct CustomTarget {
+        StringList inputs;
+        StringList outputs;
+    };
+
+    explicit GraphCache(const std::string& fileName);
+
+    void addProjectFile(const std::string& fileName);
+    void addCompilation(const Compilation& compilation) { m_compilations.push_back(compilation); }
+    void addLink(const Link& link) { m_links.push_back(link); }
+    void addCustomTarget(const CustomTarget& customTarget) { m_customTargets.push_back(customTarget); }
+    /// Some node can only be checked by running Lua code.
+    void setNeedsLua() { m_needsLua = true; }
+
+    /// Save the snapshot of the build of \p targets.
+    void save(const StringList& targets);
+    /// Load a snapshot of the build of \p targets, returns false if there's none or it's outdated.
+    bool load(const StringList& targets);
+    /// Remove the snapshot, e.g. when the project is configured again.
+    void remove();
+    /// True if nothing would be built, using the dependencies and command signatures in \p depsLog.
+    bool isBuildUpToDate(DepsLog& depsLog) const;
+private:
+    std::string m_fileName;
+    bool m_needsLua;
+    // Project files and their modification times when the snapshot was taken.
+    std::vector<std::pair<std::string, long long> > m_projectFiles;
+    std::vector<Compilation> m_compilations;
+    std::vector<Link> m_links;
+    std::vector<CustomTarget> m_customTargets;
+};
+
+#endif
@@ -18,10 +18,15 @@
 
 #include "job.h"
 #include "nodetree.h"
-#include <thread>
+#include "os.h"
+#include <algorithm>
 
 Job::Job(NodeGuard* nodeGuard)
     : m_result(0)
+    , m_slot(-1)
+    , m_startTime(0)
+    , m_finishTime(0)
+    , m_expectedPeakMemory(0)
     , m_nodeGuard(nodeGuard)
 {
 }
@@ -31,17 +36,43 @@ Job::~Job()
     delete m_nodeGuard;
 }
 
-void initJobThread(Job* job)
+void Job::run()
 {
-    int result = job->doRun();
-    job->onFinished(result);
-    if (result)
-        job->m_nodeGuard->failed();
-    delete job;
+    setStarted();
+    setFinished(doRun());
 }
 
-void Job::run()
+void Job::setStarted()
+{
+    m_startTime = OS::getTimeInMicros();
+}
+
+void Job::setFinished(int result)
+{
+    m_result = result;
+    m_finishTime = OS::getTimeInMicros();
+    for (const std::string& output : m_outputs)
+        OS::invalidateFileInfo(output);
+    if (!m_result && m_successCallback)
+        m_successCallback();
+    m_nodeGuard->stats().duration = std::max(1ull, (m_finishTime - m_startTime) / 1000);
+    if (m_result)
+        m_nodeGuard->failed();
+}
+
+std::string Job::nodeName() const
+{
+    return m_nodeGuard->node()->name;
+}
+
+std::string Job::targetName() const
+{
+    const Node* node = m_nodeGuard->node();
+    return node->isTarget ? node->name : node->parents.front()->name;
+}
+
+void Job::setResourceUsage(const OS::ResourceUsage& usage)
 {
-    std::thread t(initJobThread, this);
-    t.detach();
+    m_resourceUsage = usage;
+    m_nodeGuard->stats().usage = usage;
 }
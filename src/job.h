@@ -19,6 +19,7 @@
 #ifndef JOB_H
 #define JOB_H
 #include "basictypes.h"
+#include "os.h"
 #include <functional>
 
 class NodeGuard;
@@ -28,28 +29,58 @@ class Job
 public:
     Job(NodeGuard* nodeGuard);
     virtual ~Job();
+    /// Runs the job in the current thread, called by one of the JobManager workers.
     void run();
     void setName(const std::string& name) { m_name = name; }
     std::string name() const { return m_name; }
     int result() const { return m_result; }
+    /// Name of the node built by this job and of its target.
+    std::string nodeName() const;
+    std::string targetName() const;
+    /// Job slot used to run this job, between 0 and the maximum number of jobs running at once.
+    void setSlot(int slot) { m_slot = slot; }
+    int slot() const { return m_slot; }
+    /// When the job started and finished, in microseconds as returned by OS::getTimeInMicros().
+    unsigned long long startTime() const { return m_startTime; }
+    unsigned long long finishTime() const { return m_finishTime; }
 
     void setWorkingDirectory(const std::string& dir) { m_workingDir = dir; }
     std::string workingDirectory() { return m_workingDir; }
 
-    std::function<void(int)> onFinished;
+    /// Files written by this job, their cached metadata is invalidated when the job finishes.
+    void addOutput(const std::string& fileName) { m_outputs.push_back(fileName); }
+
+    /// \p callback is called in the job thread after it finishes successfully, before its node is marked as built.
+    void setSuccessCallback(const std::function<void()>& callback) { m_successCallback = callback; }
+
+    /// Memory in KiB this job is expected to use, based on previous builds, 0 if unknown.
+    void setExpectedPeakMemory(unsigned long peakMemory) { m_expectedPeakMemory = peakMemory; }
+    unsigned long expectedPeakMemory() const { return m_expectedPeakMemory; }
+    /// Resources used by the process run by this job, all zero if the job didn't run a process.
+    const OS::ResourceUsage& resourceUsage() const { return m_resourceUsage; }
 
 protected:
     virtual int doRun() = 0;
+    /// Used by jobs not executed by run(), to tell when they started and finished.
+    void setStarted();
+    void setFinished(int result);
+    /// Record the resources used by the process run by this job.
+    void setResourceUsage(const OS::ResourceUsage& usage);
 private:
     std::string m_name;
     int m_result;
     std::string m_workingDir;
+    StringList m_outputs;
+    std::function<void()> m_successCallback;
+    int m_slot;
+    unsigned long long m_startTime;
+    unsigned long long m_finishTime;
+    unsigned long m_expectedPeakMemory;
+    OS::ResourceUsage m_resourceUsage;
 
     NodeGuard* m_nodeGuard;
 
     Job(const Job&) = delete;
-
-    friend void initJobThread(Job*);
 };
 
 #endif // JOB_H
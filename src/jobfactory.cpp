@@ -19,152 +19,244 @@
 #include "jobfactory.h"
 
 #include "compileroptions.h"
+#include "elfinterface.h"
+#include "filehash.h"
+#include "graphcache.h"
 #include "stdstringsux.h"
 #include "linkeroptions.h"
 #include "meiquecache.h"
 #include "meiquescript.h"
 #include "nodetree.h"
 #include "nodevisitor.h"
+#include "objectcache.h"
+#include "remotecache.h"
 #include "oscommandjob.h"
 #include "logger.h"
 #include "luacpputil.h"
 #include "luajob.h"
+#include "tracer.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
 
 JobFactory::JobFactory(MeiqueScript& script, const StringList& targets)
     : m_script(script)
     , m_nodeTree(script, targets)
     , m_root(nullptr)
-    , m_needToWait(false)
     , m_processedNodes(0)
+    , m_maxFailures(1)
+    , m_hashInputs(false)
+    , m_objectCache(nullptr)
+    , m_remoteCache(nullptr)
 {
-    m_nodeTree.onTreeChange = [&]() {
-        m_treeChangedMutex.lock();
-        m_treeChangedMeanWhile = true;
-        m_treeChangedMutex.unlock();
-        m_treeChanged.notify_all();
-    };
-
     m_root = m_nodeTree.root();
     if (!m_root)
         return;
 
+    m_depsLog.open(m_script.buildDir() + "meiquedeps.bin");
+    if (m_script.cache().isRelocatable())
+        ObjectCache::setRelocationRoots(m_script.sourceDir(), m_script.buildDir());
+
     NodeVisitor<>(m_root, [&](Node* node){
         cacheTargetCompilerOptions(node);
         mergeCompilerAndLinkerOptions(node);
+        setupPrecompiledHeader(node);
     });
 }
 
 JobFactory::~JobFactory()
 {
+    saveNodeStats();
     for (auto i : m_targetCompilerOptions)
         delete i.second;
 }
 
-Job* JobFactory::createJob()
+void JobFactory::setParentsShouldBuild(Node* node)
 {
-    if (!m_root)
-        return nullptr;
-
-    Job* job = nullptr;
-    Node* target;
-    Node* node;
-
-    do {
-        m_treeChangedMeanWhile = false;
-        m_needToWait = false;
-        {
-            std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
-            node = findAGoodNode(&target, m_root);
-            // Found a not expanded target, expand it then search a good node again.
-            if (node && node->isTarget && node->status == Node::Pristine) {
-                std::lock_guard<LuaState> lock(m_script.luaState());
-                m_nodeTree.expandTargetNode(node);
-                node = findAGoodNode(&target, node);
-            }
+    // Targets linking with a shared library only relink if its interface changed, see prepareLink().
+    if (isSharedLibrary(node)) {
+        setCustomTargetsShouldBuild(node);
+        return;
+    }
+    // A node marked to be built already had its parents marked too.
+    for (Node* parent : node->parents) {
+        if (!parent->shouldBuild) {
+            parent->shouldBuild = 1;
+            setParentsShouldBuild(parent);
         }
-        if (!node) {
-            if (m_needToWait && !m_treeChangedMeanWhile) {
-                std::unique_lock<std::mutex> lock(m_treeChangedMutex);
-                m_treeChanged.wait(lock);
-                if (m_nodeTree.hasFail())
-                    break;
-                continue;
-            }
-            break;
+    }
+}
+
+void JobFactory::setCustomTargetsShouldBuild(Node* node)
+{
+    NodeVisitor<NodeGetParent>(node, [this, node](Node* parent) {
+        if (node != parent && parent->isCustomTarget() && !parent->shouldBuild) {
+            parent->shouldBuild = 1;
+            setParentsShouldBuild(parent);
         }
+    });
+}
 
-        node->status = Node::Building;
-        m_processedNodes++;
+bool JobFactory::isSharedLibrary(Node* node)
+{
+    return node->isLibraryTarget() && m_targetCompilerOptions[node]->linkerOptions.linkType() == LinkerOptions::SharedLibrary;
+}
 
-        std::lock_guard<LuaState> lock(m_script.luaState());
-        std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+bool JobFactory::canCheckEarly(Node* target)
+{
+    if (target->isFake || target->isCustomTarget() || target->status != Node::Pristine)
+        return false;
+    bool canCheck = true;
+    NodeVisitor<>(target, [&](Node* node) {
+        if (node->isHook || node->isCustomTarget())
+            canCheck = false;
+    });
+    return canCheck;
+}
 
-        if (node->isCustomTarget())
-            job = createCustomTargetJob(target);
-        else if (node->isTarget)
-            job = createTargetJob(node);
-        else if (node->isHook)
-            job = createHookJob(target, node);
-        else
-            job = createCompilationJob(target, node);
-    } while(!job);
+void JobFactory::checkUpToDate(unsigned threadCount)
+{
+    if (!m_root)
+        return;
 
-    if (job) {
+    TraceScope trace("Up-to-date pre-pass");
+    std::vector<Node*> nodes;
+    std::vector<Compilation> compilations;
+    {
         std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
-        if (!node->isFake) {
-            NodeVisitor<NodeGetParent>(node, [node](Node* parent) {
-                if (node != parent)
-                    parent->shouldBuild = 1;
-            });
+        std::lock_guard<LuaState> lock(m_script.luaState());
+
+        std::vector<Node*> targets;
+        NodeVisitor<>(m_root, [&](Node* node) {
+            if (node->isTarget && canCheckEarly(node))
+                targets.push_back(node);
+        });
+        for (Node* target : targets) {
+            m_nodeTree.expandTargetNode(target);
+            for (Node* node : target->children) {
+                if (node->isTarget || node->isFake || node->shouldBuild || node->status != Node::Pristine)
+                    continue;
+                nodes.push_back(node);
+                compilations.push_back(prepareCompilation(target, node));
+            }
         }
     }
+    if (nodes.empty())
+        return;
 
-    return job;
+    // The checks are mostly stat() calls, so they scale well with the number of threads.
+    enum { Outdated, UpToDate, FetchedFromCache };
+    std::vector<char> upToDate(nodes.size(), Outdated);
+    std::atomic<size_t> next(0);
+    auto check = [&] {
+        for (size_t i = next++; i < nodes.size(); i = next++) {
+            try {
+                if (isUpToDate(compilations[i]))
+                    upToDate[i] = UpToDate;
+                else if (fetchFromCache(compilations[i]))
+                    upToDate[i] = FetchedFromCache;
+            } catch (const Error&) {
+                // Let it fail again when the node is processed.
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(threadCount, nodes.size()); ++i)
+        threads.push_back(std::thread(check));
+    check();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    unsigned builtCount = 0;
+    unsigned fetchedCount = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (upToDate[i] == FetchedFromCache) {
+            setParentsShouldBuild(nodes[i]);
+            fetchedCount++;
+        } else if (upToDate[i] == UpToDate) {
+            builtCount++;
+        } else {
+            nodes[i]->shouldBuild = true;
+            nodes[i]->cacheMiss = m_objectCache != nullptr;
+            continue;
+        }
+        m_nodeTree.setNodeBuilt(nodes[i]);
+        m_processedNodes++;
+    }
+    Debug() << builtCount << " of " << nodes.size() << " objects are up to date, " << fetchedCount << " fetched from the object cache.";
 }
 
-Node* JobFactory::findAGoodNode(Node** target, Node* node)
+Job* JobFactory::createJob()
 {
-    if (node->status >= Node::Building)
+    if (!m_root)
         return nullptr;
 
-    if (node->isTarget)
-        *target = node;
+    std::unique_lock<NodeTree> nodeTreeLock(m_nodeTree);
+    while (true) {
+        if (m_nodeTree.isFinished() || (m_maxFailures && m_nodeTree.failureCount() >= m_maxFailures))
+            return nullptr;
 
-    if (node->children.empty())
-        return node;
+        Node* node = m_nodeTree.takeReadyNode();
+        if (!node) {
+            m_nodeTree.waitForChanges(nodeTreeLock);
+            continue;
+        }
 
-    bool hasChildrenBuilding = false;
-    bool hasDependenceBuilding = false;
-    for (Node* child : node->children) {
-        hasChildrenBuilding |= child->status < Node::Built;
+        // The fake root has nothing to do, it's built when all its children are.
+        if (node->isFake && !node->isHook) {
+            m_nodeTree.setNodeBuilt(node);
+            continue;
+        }
+
+        std::lock_guard<LuaState> lock(m_script.luaState());
 
-        // Don't build files from this target if some dependence still building
-        hasDependenceBuilding |= (child->isTarget || child->isHook) && child->status < Node::Built;
-        if (hasDependenceBuilding && !child->isTarget && !child->isHook)
+        // Found up to date by checkUpToDate(), or a target expanded by it that was already ready
+        // and got queued again when its files were built.
+        if (node->status == Node::Built || node->status == Node::Building)
             continue;
 
-        if (child->status < Node::Building) {
-            Node* nodeFound = findAGoodNode(target, child);
-            if (nodeFound)
-                return nodeFound;
+        // All dependencies of this target were built, expand it to know about its files.
+        if (node->isTarget && node->status == Node::Pristine)
+            m_nodeTree.expandTargetNode(node);
+        // Targets expanded by checkUpToDate() may be ready before their files were built.
+        if (node->pendingChildren)
+            continue;
+
+        node->status = Node::Building;
+        m_processedNodes++;
+
+        // The first parent of files, precompiled headers and hooks is their target.
+        Node* target = node->isTarget ? node : node->parents.front();
+
+        Job* job;
+        if (node->isCustomTarget()) {
+            job = createCustomTargetJob(target);
+        } else if (node->isHook) {
+            job = createHookJob(target, node);
+        } else {
+            TraceScope trace("Up-to-date check", node->name);
+            job = node->isTarget ? createTargetJob(node) : createCompilationJob(target, node);
         }
-    }
-    if (node->isFake)
-        return nullptr;
 
-    if (hasChildrenBuilding) {
-        m_needToWait = true;
-        return nullptr;
-    }
+        if (!job)
+            continue;
+        job->setExpectedPeakMemory(m_nodeTree.expectedPeakMemory(target, node));
 
-    return node;
+        // Restat targets only do it after they run, if their outputs changed.
+        if (!node->isFake && !node->restat)
+            setParentsShouldBuild(node);
+        return job;
+    }
 }
 
-Job* JobFactory::createCompilationJob(Node* target, Node* node)
+JobFactory::Compilation JobFactory::prepareCompilation(Node* target, Node* node)
 {
-    node->status = Node::Building;
-
     Options* options = m_targetCompilerOptions[target];
     const std::string sourceDir = m_script.sourceDir() + options->targetDirectory;
     const std::string buildDir = m_script.buildDir() + options->targetDirectory;
@@ -172,43 +264,169 @@ Job* JobFactory::createCompilationJob(Node* target, Node* node)
 
     Compiler* compiler = m_script.cache().compiler();
 
-    std::string source = fileName.at(0) == '/' ? fileName : sourceDir + fileName;
-    std::string output = compiler->nameForObject(node->name, target->name);
-    if (output.at(0) != '/')
-        output.insert(0, buildDir);
-    output = OS::normalizeFilePath(output);
-    source = OS::normalizeFilePath(source);
+    Compilation compilation;
+    compilation.source = fileName.at(0) == '/' ? fileName : sourceDir + fileName;
+    compilation.source = OS::normalizeFilePath(compilation.source);
+    compilation.cacheable = !node->isPrecompiledHeader;
+    if (node->isPrecompiledHeader) {
+        compilation.output = options->compilerOptions.precompiledHeader();
+        compilation.command = compiler->precompileHeader(compilation.source, compilation.output, &options->compilerOptions);
+    } else {
+        compilation.output = compiler->nameForObject(node->name, target->name);
+        if (compilation.output.at(0) != '/')
+            compilation.output.insert(0, buildDir);
+        compilation.output = OS::normalizeFilePath(compilation.output);
+        compilation.command = compiler->compile(compilation.source, compilation.output, &options->compilerOptions);
+    }
+    compilation.commandHash = DepsLog::commandHash(compilation.command);
+    compilation.workingDirectory = buildDir;
+    return compilation;
+}
+
+bool JobFactory::isUpToDate(const Compilation& compilation)
+{
+    if (m_depsLog.recordedCommandHash(compilation.output) != compilation.commandHash)
+        return false;
+    Compiler* compiler = m_script.cache().compiler();
+    if (m_hashInputs)
+        return !inputsChanged(compiler, compilation.output);
+    return !compiler->shouldCompile(compilation.source, compilation.output, m_depsLog);
+}
 
-    if (!node->shouldBuild && !compiler->shouldCompile(source, output)) {
-        node->status = Node::Built;
+Job* JobFactory::createCompilationJob(Node* target, Node* node)
+{
+    node->status = Node::Building;
+
+    Compilation compilation = prepareCompilation(target, node);
+    if (!node->shouldBuild && isUpToDate(compilation)) {
+        m_nodeTree.setNodeBuilt(node);
         return nullptr;
     }
 
+    const std::string& output = compilation.output;
+    const uint64_t commandHash = compilation.commandHash;
+    Compiler* compiler = m_script.cache().compiler();
+
     std::string outputDir = OS::dirName(output);
     if (!OS::dirExists(outputDir))
         OS::mkdir(outputDir);
 
-    OSCommandJob* job = new OSCommandJob(new NodeGuard(m_nodeTree, node), compiler->compile(source, output, &options->compilerOptions));
-    job->setWorkingDirectory(buildDir);
-    job->setName("Compiling " + OS::baseName(fileName));
+    // Files are compiled with the header beside the .gch, used when the .gch doesn't fit, so it must include the real one.
+    if (node->isPrecompiledHeader) {
+        std::ofstream header(output.substr(0, output.size() - 4).c_str(), std::ios::out | std::ios::trunc);
+        header << "#include \"" << compilation.source << "\"\n";
+    }
+
+    ObjectCache* objectCache = compilation.cacheable ? m_objectCache : nullptr;
+    RemoteCache* remoteCache = compilation.cacheable ? m_remoteCache : nullptr;
+    // Nodes checked by checkUpToDate() were already looked up in the object cache.
+    const bool lookUpObjectCache = objectCache && !node->cacheMiss;
+
+    OSCommandJob* job = new OSCommandJob(new NodeGuard(m_nodeTree, node), compilation.command);
+    job->setWorkingDirectory(compilation.workingDirectory);
+    job->setName((node->isPrecompiledHeader ? "Precompiling " : "Compiling ") + OS::baseName(node->name));
+    job->addOutput(output);
+    job->addOutput(output + ".d");
+
+    // Hashing the source and the cache lookups may be slow, so they are done by the job instead of here,
+    // where the node tree and Lua are locked.
+    auto cacheKey = std::make_shared<uint64_t>(0);
+    auto fetchedLocally = std::make_shared<bool>(false);
+    auto fetchedRemotely = std::make_shared<bool>(false);
+    if (objectCache || remoteCache) {
+        job->setPrelude([this, job, compilation, lookUpObjectCache, remoteCache, cacheKey, fetchedLocally, fetchedRemotely] {
+            const std::string& output = compilation.output;
+            *cacheKey = ObjectCache::key(compilation.command, compilation.workingDirectory, output, m_depsLog.fileHash(compilation.source));
+            *fetchedLocally = lookUpObjectCache && fetchFromCache(compilation);
+            if (*fetchedLocally) {
+                job->setName("Fetching " + OS::baseName(output) + " from the object cache");
+                return true;
+            }
+            *fetchedRemotely = remoteCache && remoteCache->fetch(*cacheKey, output, m_depsLog);
+            if (*fetchedRemotely)
+                job->setName("Fetching " + OS::baseName(output) + " from the remote cache");
+            return *fetchedRemotely;
+        });
+    }
+    job->setSuccessCallback([this, compiler, output, commandHash, objectCache, remoteCache, cacheKey, fetchedLocally, fetchedRemotely] {
+        // Already recorded by fetchFromCache().
+        if (*fetchedLocally)
+            return;
+        compiler->ingestDependencies(output, m_depsLog);
+        m_depsLog.recordCommandHash(output, commandHash);
+        if (m_hashInputs)
+            recordInputsHash(output);
+        if (objectCache)
+            objectCache->store(*cacheKey, output, m_depsLog);
+        if (remoteCache && !*fetchedRemotely)
+            remoteCache->store(*cacheKey, output, m_depsLog);
+    });
 
     return job;
 }
 
-Job* JobFactory::createTargetJob(Node* target)
+bool JobFactory::fetchFromCache(const Compilation& compilation)
+{
+    if (!m_objectCache || !compilation.cacheable)
+        return false;
+    const uint64_t sourceHash = m_depsLog.fileHash(compilation.source);
+    if (!sourceHash)
+        return false;
+
+    const std::string& output = compilation.output;
+    const std::string outputDir = OS::dirName(output);
+    if (!OS::dirExists(outputDir))
+        OS::mkdir(outputDir);
+    if (!m_objectCache->fetch(ObjectCache::key(compilation.command, compilation.workingDirectory, output, sourceHash), output, m_depsLog))
+        return false;
+
+    Debug() << "Fetched " << output << " from the object cache.";
+    Compiler* compiler = m_script.cache().compiler();
+    compiler->ingestDependencies(output, m_depsLog);
+    m_depsLog.recordCommandHash(output, compilation.commandHash);
+    if (m_hashInputs)
+        recordInputsHash(output);
+    return true;
+}
+
+bool JobFactory::inputsChanged(Compiler* compiler, const std::string& output)
+{
+    const long long outputTime = OS::modificationTime(output);
+    if (!outputTime)
+        return true;
+
+    // The source file is the first dependency.
+    std::vector<const std::string*> inputs;
+    if (!m_depsLog.dependencies(output, outputTime, inputs)) {
+        if (!compiler->ingestDependencies(output, m_depsLog) || !m_depsLog.dependencies(output, outputTime, inputs))
+            return true;
+    }
+
+    const uint64_t recordedHash = m_depsLog.recordedInputsHash(output);
+    return !recordedHash || recordedHash != m_depsLog.inputsHash(inputs);
+}
+
+void JobFactory::recordInputsHash(const std::string& output)
+{
+    std::vector<const std::string*> inputs;
+    if (m_depsLog.dependencies(output, OS::modificationTime(output), inputs))
+        m_depsLog.recordInputsHash(output, m_depsLog.inputsHash(inputs));
+    // Outputs are hashed too, so they can be compared with what was built before.
+    m_depsLog.fileHash(output);
+}
+
+JobFactory::Compilation JobFactory::prepareLink(Node* target)
 {
     lua_State* L = m_script.luaState();
     LuaLeakCheck(L);
 
-    target->status = Node::Building;
-
     Compiler* compiler = m_script.cache().compiler();
     Options* options = m_targetCompilerOptions[target];
     const std::string buildDir = m_script.buildDir() + options->targetDirectory;
 
     StringList objects;
     for (Node* child : target->children) {
-        if (!child->isTarget && !child->isFake)
+        if (!child->isTarget && !child->isFake && !child->isPrecompiledHeader)
             objects.push_back(compiler->nameForObject(child->name, target->name));
     }
 
@@ -216,15 +434,55 @@ Job* JobFactory::createTargetJob(Node* target)
     std::string outputName = luaGetField<std::string>(L, "_output");
     lua_pop(L, 1);
 
+    Compilation link;
+    link.output = buildDir + outputName;
+    link.command = compiler->link(outputName, objects, &options->linkerOptions, options->targetDirectory);
+    link.commandHash = DepsLog::commandHash(link.command);
+    link.cacheable = false;
+
+    // The interface of the shared libraries used is part of the command, so it relinks when they change.
+    if (options->linkerOptions.linkType() != LinkerOptions::StaticLibrary) {
+        NodeVisitor<>(target, [&](Node* node) {
+            if (node == target || !isSharedLibrary(node))
+                return;
+            Options* libOptions = m_targetCompilerOptions[node];
+            link.libraries.push_back(m_script.buildDir() + libOptions->targetDirectory + compiler->nameForSharedLibrary(node->name));
+        });
+        link.commandHash = m_depsLog.linkCommandHash(link.commandHash, link.libraries);
+    }
+    return link;
+}
+
+Job* JobFactory::createTargetJob(Node* target)
+{
+    target->status = Node::Building;
+
+    Compilation link = prepareLink(target);
+    const std::string& output = link.output;
+    const uint64_t commandHash = link.commandHash;
+
     // Check if the target must be build
-    if (!target->shouldBuild && OS::fileExists(buildDir + outputName)) {
-        target->status = Node::Built;
+    if (!target->shouldBuild && m_depsLog.recordedCommandHash(output) == commandHash && OS::fileExists(output)) {
+        m_nodeTree.setNodeBuilt(target);
         return nullptr;
     }
 
-    OSCommandJob* job = new OSCommandJob(new NodeGuard(m_nodeTree, target), compiler->link(outputName, objects, &options->linkerOptions, options->targetDirectory));
-    job->setWorkingDirectory(buildDir);
-    job->setName("Linking " + outputName);
+    OSCommandJob* job = new OSCommandJob(new NodeGuard(m_nodeTree, target), link.command);
+    job->setWorkingDirectory(m_script.buildDir() + m_targetCompilerOptions[target]->targetDirectory);
+    job->setName("Linking " + OS::baseName(output));
+    job->addOutput(output);
+    const bool sharedLibrary = isSharedLibrary(target);
+    job->setSuccessCallback([this, output, commandHash, sharedLibrary] {
+        m_depsLog.recordCommandHash(output, commandHash);
+        if (sharedLibrary) {
+            // Not an ELF file? Fallback to the file contents, so users relink on every change.
+            uint64_t interfaceHash = hashElfInterface(output);
+            if (!interfaceHash)
+                interfaceHash = hashFile(output);
+            Debug() << "Interface hash of " << output << ": " << interfaceHash;
+            m_depsLog.recordInterfaceHash(output, interfaceHash);
+        }
+    });
 
     return job;
 }
@@ -242,28 +500,30 @@ Job* JobFactory::createCustomTargetJob(Node* target)
     StringList files = luaGetField<StringList>(L, "_files");
 
     Options* options = m_targetCompilerOptions[target];
+    const std::string buildDir = m_script.buildDir() + options->targetDirectory;
+    const std::string sourceDir = m_script.sourceDir() + options->targetDirectory;
+    StringList outputs = luaGetField<StringList>(L, "_outputs");
+    for (std::string& output : outputs)
+        output.insert(0, buildDir);
 
-    if (!target->shouldBuild) {
-        const std::string buildDir = m_script.buildDir() + options->targetDirectory;
-        const std::string sourceDir = m_script.sourceDir() + options->targetDirectory;
-
-        StringList outputs = luaGetField<StringList>(L, "_outputs");
-        if (!outputs.empty()) {
-            bool shouldRun = false;
-            for (const std::string& file : files) {
-                for (const std::string& output : outputs) {
-                    if (OS::timestampCompare(sourceDir + file, buildDir + output) < 0) {
-                        shouldRun = true;
-                        break;
-                    }
-                }
-                if (shouldRun)
+    if (!target->shouldBuild && !outputs.empty()) {
+        bool shouldRun = false;
+        for (const std::string& file : files) {
+            for (const std::string& output : outputs) {
+                if (OS::timestampCompare(sourceDir + file, output) < 0) {
+                    shouldRun = true;
                     break;
+                }
             }
-            if (!shouldRun) {
-                target->status = Node::Built;
-                return nullptr;
-            }
+            if (shouldRun)
+                break;
+        }
+        // Restat targets keep the old modification time of unchanged outputs, so check if the inputs really changed.
+        if (shouldRun && target->restat)
+            shouldRun = customTargetInputsChanged(files, sourceDir, outputs);
+        if (!shouldRun) {
+            m_nodeTree.setNodeBuilt(target);
+            return nullptr;
         }
     }
 
@@ -272,11 +532,62 @@ Job* JobFactory::createCustomTargetJob(Node* target)
 
     LuaJob* job = new LuaJob(new NodeGuard(m_nodeTree, target), L, 1);
     job->setName("Running custom target " + std::string(target->name));
-    job->setWorkingDirectory(m_script.sourceDir() + options->targetDirectory);
+    job->setWorkingDirectory(sourceDir);
+    for (const std::string& output : outputs)
+        job->addOutput(output);
+
+    if (target->restat && !outputs.empty()) {
+        std::vector<std::pair<long long, uint64_t> > before;
+        for (const std::string& output : outputs)
+            before.push_back(std::make_pair(OS::modificationTime(output), hashFile(output)));
+
+        job->setSuccessCallback([this, target, files, sourceDir, outputs, before] {
+            // Unchanged outputs get their old modification time back, so nothing using them looks outdated.
+            bool changed = false;
+            auto it = before.begin();
+            for (const std::string& output : outputs) {
+                const uint64_t hash = hashFile(output);
+                if (it->first && hash && hash == it->second)
+                    OS::setModificationTime(output, it->first);
+                else
+                    changed = true;
+                ++it;
+            }
+            m_depsLog.recordInputsHash(outputs.front(), customTargetInputsHash(files, sourceDir));
+
+            if (changed) {
+                std::lock_guard<NodeTree> lock(m_nodeTree);
+                setParentsShouldBuild(target);
+            } else {
+                Debug() << "Outputs of " << target->name << " didn't change.";
+            }
+        });
+    }
 
     return job;
 }
 
+uint64_t JobFactory::customTargetInputsHash(const StringList& files, const std::string& sourceDir)
+{
+    StringList inputs;
+    for (const std::string& file : files)
+        inputs.push_back(OS::normalizeFilePath(sourceDir + file));
+    std::vector<const std::string*> inputPtrs;
+    for (const std::string& input : inputs)
+        inputPtrs.push_back(&input);
+    return m_depsLog.inputsHash(inputPtrs);
+}
+
+bool JobFactory::customTargetInputsChanged(const StringList& files, const std::string& sourceDir, const StringList& outputs)
+{
+    for (const std::string& output : outputs) {
+        if (!OS::fileExists(output))
+            return true;
+    }
+    const uint64_t recordedHash = m_depsLog.recordedInputsHash(outputs.front());
+    return !recordedHash || recordedHash != customTargetInputsHash(files, sourceDir);
+}
+
 Job* JobFactory::createHookJob(Node* target, Node* node)
 {
     LuaState& L = m_script.luaState();
@@ -319,6 +630,25 @@ static void readMeiquePackageOnStack(lua_State* L, CompilerOptions& compilerOpti
     linkerOptions.addLibraries(split(map["linkLibraries"]));
 }
 
+// Path of directory \p to relative to directory \p from, both absolute and ending with a slash.
+static std::string relativePath(const std::string& from, const std::string& to)
+{
+    size_t common = 0;
+    for (size_t i = 0; i < from.size() && i < to.size() && from[i] == to[i]; ++i) {
+        if (from[i] == '/')
+            common = i + 1;
+    }
+    std::string path;
+    for (size_t i = common; i < from.size(); ++i) {
+        if (from[i] == '/')
+            path += "../";
+    }
+    path += to.substr(common);
+    if (path.empty())
+        return ".";
+    return path.erase(path.size() - 1);
+}
+
 void JobFactory::fillTargetOptions(Node* node, Options* options)
 {
     assert(node->isTarget);
@@ -367,6 +697,23 @@ void JobFactory::fillTargetOptions(Node* node, Options* options)
     else
         compilerOptions.addDefine("NDEBUG");
 
+    // Paths in the objects are written relative to the build directory, the longest root goes last to win.
+    if (m_script.cache().isRelocatable()) {
+        std::string sourceRoot = m_script.sourceDir();
+        std::string buildRoot = m_script.buildDir();
+        sourceRoot.erase(sourceRoot.size() - 1);
+        buildRoot.erase(buildRoot.size() - 1);
+        const std::string relativeSourceRoot = relativePath(m_script.buildDir(), m_script.sourceDir());
+        if (sourceRoot.size() > buildRoot.size()) {
+            compilerOptions.addPathPrefixMap(buildRoot, ".");
+            compilerOptions.addPathPrefixMap(sourceRoot, relativeSourceRoot);
+        } else {
+            if (sourceRoot != buildRoot)
+                compilerOptions.addPathPrefixMap(sourceRoot, relativeSourceRoot);
+            compilerOptions.addPathPrefixMap(buildRoot, ".");
+        }
+    }
+
     StringList list;
     // explicit include directories
     list = luaGetField<StringList>(L, "_incDirs");
@@ -387,6 +734,10 @@ void JobFactory::fillTargetOptions(Node* node, Options* options)
     compilerOptions.addIncludePath(m_script.buildDir() + targetDirectory);
     compilerOptions.normalize();
 
+    // Precompiled header, set up when all targets have their options.
+    options->precompiledHeader = luaGetField<std::string>(L, "_pch");
+    options->precompiledHeaderTarget = luaGetField<std::string>(L, "_pchTarget");
+
     if (node->isLibraryTarget()) {
         compilerOptions.setCompileForLibrary(true);
         LinkerOptions::LinkType linkType;
@@ -404,12 +755,6 @@ void JobFactory::fillTargetOptions(Node* node, Options* options)
     } else {
         linkerOptions.setLinkType(LinkerOptions::Executable);
     }
-
-    std::string targetHash = compilerOptions.hash() + linkerOptions.hash();
-    if (m_script.cache().targetHash(node->name) != targetHash) {
-        node->shouldBuild = true;
-        m_script.cache().setTargetHash(node->name, targetHash);
-    }
 }
 
 void JobFactory::mergeCompilerAndLinkerOptions(Node* node)
@@ -446,6 +791,427 @@ void JobFactory::mergeCompilerAndLinkerOptions(Node* node)
     }
 }
 
+void JobFactory::setupPrecompiledHeader(Node* target)
+{
+    if (!target->isTarget || target->isCustomTarget())
+        return;
+
+    Compiler* compiler = m_script.cache().compiler();
+    Options* options = m_targetCompilerOptions[target];
+    if (!options->precompiledHeader.empty()) {
+        std::string output = compiler->nameForPrecompiledHeader(options->precompiledHeader, target->name);
+        if (output.at(0) != '/')
+            output.insert(0, m_script.buildDir() + options->targetDirectory);
+        options->compilerOptions.setPrecompiledHeader(OS::normalizeFilePath(output));
+        return;
+    }
+    if (options->precompiledHeaderTarget.empty())
+        return;
+
+    // The other target is a dependency, so it was already set up.
+    Node* pchTarget = m_nodeTree.getTargetNode(options->precompiledHeaderTarget);
+    const CompilerOptions& pchOptions = m_targetCompilerOptions[pchTarget]->compilerOptions;
+    if (pchOptions.precompiledHeader().empty())
+        throw Error("Target " + target->name + " uses the precompiled header of " + pchTarget->name + ", but it has none.");
+    if (options->compilerOptions.canUsePrecompiledHeaderOf(pchOptions))
+        options->compilerOptions.setPrecompiledHeader(pchOptions.precompiledHeader());
+    else
+        Warn() << "Target " << target->name << " can't use the precompiled header of " << pchTarget->name << ", they are compiled with different flags or include paths.";
+}
+
+void JobFactory::saveNodeStats()
+{
+    if (!m_root)
+        return;
+
+    MeiqueCache& cache = m_script.cache();
+    NodeVisitor<>(m_root, [&](Node* node) {
+        if (!node->stats.duration)
+            return;
+        if (node->isTarget)
+            cache.setNodeStats(node->name, std::string(), node->stats);
+        else
+            cache.setNodeStats(node->parents.front()->name, node->name, node->stats);
+    });
+}
+
+void JobFactory::visitNodeFiles(const std::function<void(Node*, const std::string&, bool isOutput)>& visitor)
+{
+    lua_State* L = m_script.luaState();
+    LuaLeakCheck(L);
+
+    NodeVisitor<>(m_root, [&](Node* target) {
+        if (!target->isTarget || target->isFake || target->status == Node::Pristine)
+            return;
+
+        Options* options = m_targetCompilerOptions[target];
+        const std::string buildDir = m_script.buildDir() + options->targetDirectory;
+        m_script.luaPushTarget(target->name);
+        LuaAutoPop autoPop(L);
+        if (target->isCustomTarget()) {
+            const std::string sourceDir = m_script.sourceDir() + options->targetDirectory;
+            for (const std::string& file : luaGetField<StringList>(L, "_files"))
+                visitor(target, OS::normalizeFilePath(file.at(0) == '/' ? file : sourceDir + file), false);
+            for (const std::string& output : luaGetField<StringList>(L, "_outputs"))
+                visitor(target, OS::normalizeFilePath(buildDir + output), true);
+            return;
+        }
+
+        visitor(target, OS::normalizeFilePath(buildDir + luaGetField<std::string>(L, "_output")), true);
+        for (Node* node : target->children) {
+            if (node->isTarget || node->isFake)
+                continue;
+            const Compilation compilation = prepareCompilation(target, node);
+            visitor(node, compilation.source, false);
+            visitor(node, compilation.output, true);
+            // The header written beside the .gch, see createCompilationJob().
+            if (node->isPrecompiledHeader)
+                visitor(node, compilation.output.substr(0, compilation.output.size() - 4), true);
+            std::vector<const std::string*> deps;
+            if (m_depsLog.dependencies(compilation.output, OS::modificationTime(compilation.output), deps)) {
+                for (const std::string* dep : deps)
+                    visitor(node, OS::normalizeFilePath(*dep), false);
+            }
+        }
+    });
+}
+
+StringSet JobFactory::nodeFiles()
+{
+    StringSet files;
+    if (!m_root)
+        return files;
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    std::lock_guard<LuaState> lock(m_script.luaState());
+    visitNodeFiles([&](Node*, const std::string& file, bool) {
+        files.insert(file);
+    });
+    return files;
+}
+
+StringSet JobFactory::outputFiles()
+{
+    StringSet files;
+    if (!m_root)
+        return files;
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    std::lock_guard<LuaState> lock(m_script.luaState());
+    visitNodeFiles([&](Node*, const std::string& file, bool isOutput) {
+        if (isOutput)
+            files.insert(file);
+    });
+    return files;
+}
+
+void JobFactory::rescheduleChangedFiles(const StringList& changedFiles, const StringList& changedDuringBuild)
+{
+    if (!m_root)
+        return;
+
+    const StringSet changed(changedFiles.begin(), changedFiles.end());
+    const StringSet stale(changedDuringBuild.begin(), changedDuringBuild.end());
+    std::vector<Node*> nodes;
+    std::vector<Node*> staleNodes;
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    std::lock_guard<LuaState> lock(m_script.luaState());
+    visitNodeFiles([&](Node* node, const std::string& file, bool) {
+        if ((changed.count(file) || stale.count(file)) && (nodes.empty() || nodes.back() != node))
+            nodes.push_back(node);
+        if (stale.count(file) && (staleNodes.empty() || staleNodes.back() != node))
+            staleNodes.push_back(node);
+    });
+
+    const unsigned count = m_nodeTree.rescheduleNodes(nodes);
+    m_processedNodes = m_nodeTree.size() - count;
+    // Saved while compiling, the output can be newer than the file but still have the old contents.
+    for (Node* node : staleNodes)
+        node->shouldBuild = true;
+}
+
+void JobFactory::saveGraph(GraphCache& graph)
+{
+    if (!m_root)
+        return;
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    std::lock_guard<LuaState> lock(m_script.luaState());
+    lua_State* L = m_script.luaState();
+    LuaLeakCheck(L);
+
+    NodeVisitor<>(m_root, [&](Node* node) {
+        if (node->isHook)
+            graph.setNeedsLua();
+        if (!node->isTarget || node->isFake)
+            return;
+
+        Options* options = m_targetCompilerOptions[node];
+        if (node->isCustomTarget()) {
+            const std::string sourceDir = m_script.sourceDir() + options->targetDirectory;
+            const std::string buildDir = m_script.buildDir() + options->targetDirectory;
+            m_script.luaPushTarget(node->name);
+            LuaAutoPop autoPop(L);
+
+            // Without outputs they run on every build.
+            GraphCache::CustomTarget customTarget;
+            for (const std::string& output : luaGetField<StringList>(L, "_outputs"))
+                customTarget.outputs.push_back(buildDir + output);
+            if (customTarget.outputs.empty())
+                graph.setNeedsLua();
+            for (const std::string& file : luaGetField<StringList>(L, "_files"))
+                customTarget.inputs.push_back(sourceDir + file);
+            graph.addCustomTarget(customTarget);
+            return;
+        }
+
+        for (Node* child : node->children) {
+            if (child->isTarget || child->isFake)
+                continue;
+            const Compilation compilation = prepareCompilation(node, child);
+            graph.addCompilation({ compilation.source, compilation.output, compilation.commandHash });
+        }
+        const Compilation link = prepareLink(node);
+        // Without the interface hashes, they are checked again when the snapshot is used.
+        graph.addLink({ link.output, DepsLog::commandHash(link.command), link.libraries });
+    });
+}
+
+StringList JobFactory::failedTargets()
+{
+    StringList targets;
+    if (!m_root)
+        return targets;
+
+    std::lock_guard<NodeTree> lock(m_nodeTree);
+    NodeVisitor<>(m_root, [&](Node* node) {
+        if (node->isTarget && node->hasFailed && !node->isFake)
+            targets.push_back(node->name);
+    });
+    return targets;
+}
+
+static std::string formatTime(unsigned long ms)
+{
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2) << ms / 1000.0 << 's';
+    return s.str();
+}
+
+void JobFactory::printStats(unsigned count)
+{
+    if (!m_root)
+        return;
+
+    std::vector<Node*> nodes;
+    NodeVisitor<>(m_root, [&](Node* node) {
+        if (node->stats.duration)
+            nodes.push_back(node);
+    });
+    if (nodes.empty())
+        return;
+
+    std::sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) {
+        const unsigned long cpuTimeA = a->stats.usage.cpuTime();
+        const unsigned long cpuTimeB = b->stats.usage.cpuTime();
+        return cpuTimeA > cpuTimeB || (cpuTimeA == cpuTimeB && a->stats.duration > b->stats.duration);
+    });
+    if (nodes.size() > count)
+        nodes.resize(count);
+
+    Notice() << "Top " << nodes.size() << " jobs by CPU time:";
+    Notice() << std::right << std::setw(9) << "CPU" << std::setw(9) << "User" << std::setw(9) << "System"
+             << std::setw(9) << "Wall" << std::setw(10) << "Max RSS" << std::setw(9) << "Blk in"
+             << std::setw(9) << "Blk out" << std::setw(9) << "Ctx sw" << std::setw(9) << "Change" << "  Node";
+
+    // Stats of the previous build are still in the cache, they are only replaced when the factory is destroyed.
+    MeiqueCache& cache = m_script.cache();
+    for (Node* node : nodes) {
+        Node* target = node->isTarget ? node : node->parents.front();
+        const OS::ResourceUsage& usage = node->stats.usage;
+        const NodeStats previous = cache.nodeStats(target->name, node == target ? std::string() : node->name);
+
+        std::string change = previous.duration ? "-" : "new";
+        if (previous.usage.cpuTime()) {
+            std::ostringstream s;
+            long delta = long(usage.cpuTime()) - long(previous.usage.cpuTime());
+            s << std::showpos << delta * 100 / long(previous.usage.cpuTime()) << '%';
+            change = s.str();
+        }
+
+        Notice() << std::right << std::setw(9) << formatTime(usage.cpuTime()) << std::setw(9) << formatTime(usage.userTime)
+                 << std::setw(9) << formatTime(usage.systemTime) << std::setw(9) << formatTime(node->stats.duration)
+                 << std::setw(7) << usage.peakMemory / 1024 << "MiB" << std::setw(9) << usage.blockInputs
+                 << std::setw(9) << usage.blockOutputs
+                 << std::setw(9) << usage.voluntaryContextSwitches + usage.involuntaryContextSwitches
+                 << std::setw(9) << change << "  " << (node == target ? target->name : target->name + ": " + node->name);
+    }
+}
+
+void JobFactory::suggestPrecompiledHeaders(const StringList& targets, unsigned count)
+{
+    if (!m_root)
+        return;
+
+    std::lock_guard<NodeTree> nodeTreeLock(m_nodeTree);
+    std::lock_guard<LuaState> lock(m_script.luaState());
+    if (targets.empty()) {
+        for (Node* target : m_nodeTree) {
+            if (!target->isCustomTarget())
+                suggestPrecompiledHeader(target, count);
+        }
+        return;
+    }
+    for (const std::string& name : targets) {
+        Node* target = m_nodeTree.getTargetNode(name);
+        if (target->isCustomTarget())
+            Warn() << "Target " << name << " is a custom target, it has nothing to compile.";
+        else
+            suggestPrecompiledHeader(target, count);
+    }
+}
+
+// Headers in the #include directives of \p fileName as written there, e.g. <string> or "foo.h".
+static StringList includeDirectives(const std::string& fileName)
+{
+    StringList includes;
+    std::ifstream file(fileName.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line[pos] != '#')
+            continue;
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos || line.compare(pos, 7, "include") != 0)
+            continue;
+        pos = line.find_first_not_of(" \t", pos + 7);
+        if (pos == std::string::npos || (line[pos] != '<' && line[pos] != '"'))
+            continue;
+        const size_t end = line.find(line[pos] == '<' ? '>' : '"', pos + 1);
+        if (end != std::string::npos)
+            includes.push_back(line.substr(pos, end - pos + 1));
+    }
+    return includes;
+}
+
+// True if the header at \p path may be the one found for the #include of \p include.
+static bool isIncludedAs(const std::string& path, const std::string& include)
+{
+    const std::string name = include.substr(1, include.size() - 2);
+    if (path.size() <= name.size())
+        return path == name;
+    return path.compare(path.size() - name.size(), name.size(), name) == 0 && path[path.size() - name.size() - 1] == '/';
+}
+
+void JobFactory::suggestPrecompiledHeader(Node* target, unsigned count)
+{
+    struct Header {
+        Header() : files(0), cpuTime(0) {}
+        std::string path;
+        /// How it's written in the #include directives, e.g. <string>.
+        std::string include;
+        unsigned files;
+        /// Part of the CPU time of all files including it spent on it and on the headers it includes, in milliseconds.
+        double cpuTime;
+    };
+    std::unordered_map<std::string, Header> headers;
+    unsigned files = 0;
+    unsigned long cpuTime = 0;
+
+    m_nodeTree.expandTargetNode(target);
+    Compiler* compiler = m_script.cache().compiler();
+    for (Node* node : target->children) {
+        if (node->isTarget || node->isFake || node->isPrecompiledHeader)
+            continue;
+        const unsigned long fileCpuTime = m_script.cache().nodeStats(target->name, node->name).usage.cpuTime();
+        const Compilation compilation = prepareCompilation(target, node);
+        const long long outputTime = OS::modificationTime(compilation.output);
+        std::vector<const std::string*> deps;
+        if (!fileCpuTime || (!m_depsLog.dependencies(compilation.output, outputTime, deps)
+            && (!compiler->ingestDependencies(compilation.output, m_depsLog) || !m_depsLog.dependencies(compilation.output, outputTime, deps)))) {
+            continue;
+        }
+
+        long long totalSize = 0;
+        for (const std::string* dep : deps)
+            totalSize += OS::fileSize(*dep);
+        if (totalSize <= 0)
+            continue;
+        files++;
+        cpuTime += fileCpuTime;
+
+        // Only headers included by the files themselves are candidates. Dependencies are listed in the order the
+        // compiler found them, so the ones after a candidate, up to the next one, were included through it.
+        StringList includes = includeDirectives(compilation.source);
+        Header* candidate = nullptr;
+        for (const std::string* dep : deps) {
+            if (*dep == compilation.source)
+                continue;
+            auto include = std::find_if(includes.begin(), includes.end(), [&](const std::string& include) {
+                return isIncludedAs(*dep, include);
+            });
+            if (include != includes.end()) {
+                candidate = &headers[*dep];
+                candidate->path = *dep;
+                if (candidate->include.empty())
+                    candidate->include = *include;
+                candidate->files++;
+                includes.erase(include);
+            }
+            if (candidate)
+                candidate->cpuTime += double(fileCpuTime) * OS::fileSize(*dep) / totalSize;
+        }
+    }
+
+    if (!files) {
+        Notice() << "No compilation of target " << target->name << " was recorded, build it first.";
+        return;
+    }
+
+    // Precompiled, each header is parsed once instead of once per file including it.
+    std::vector<Header> ranking;
+    for (const auto& pair : headers) {
+        if (pair.second.files > 1)
+            ranking.push_back(pair.second);
+    }
+    std::sort(ranking.begin(), ranking.end(), [](const Header& a, const Header& b) {
+        return a.cpuTime > b.cpuTime || (a.cpuTime == b.cpuTime && a.path < b.path);
+    });
+    if (ranking.size() > count)
+        ranking.resize(count);
+
+    Notice() << "Precompiled header candidates of " << target->name << ", " << files << " files compiled in " << formatTime(cpuTime) << " of CPU time:";
+    if (ranking.empty()) {
+        Notice() << "    None, no header is included by more than one file.";
+        return;
+    }
+    Notice() << std::right << std::setw(9) << "Files" << std::setw(9) << "Parse" << std::setw(9) << "Total" << "  Header";
+    for (const Header& header : ranking) {
+        Notice() << std::right << std::setw(9) << header.files << std::setw(9) << formatTime(header.cpuTime / header.files)
+                 << std::setw(9) << formatTime(header.cpuTime) << "  " << header.path;
+    }
+
+    // Headers included by at most half of the files would slow down the others more than they help.
+    const std::string sourceDir = OS::normalizeDirPath(m_script.sourceDir() + m_targetCompilerOptions[target]->targetDirectory);
+    unsigned long saved = 0;
+    Notice() << "Suggested precompiled header:";
+    for (const Header& header : ranking) {
+        if (header.files * 2 <= files)
+            continue;
+        const bool inSourceDir = header.path.compare(0, sourceDir.size(), sourceDir) == 0;
+        if (inSourceDir)
+            Notice() << "    #include \"" << header.path.substr(sourceDir.size()) << '"';
+        else
+            Notice() << "    #include " << header.include;
+        saved += header.cpuTime - header.cpuTime / header.files;
+    }
+    if (!saved)
+        Notice() << "    None, no header is included by more than half of the files.";
+    else
+        Notice() << "Estimated CPU time saved: " << formatTime(saved) << " (" << saved * 100 / cpuTime << "%).";
+}
+
 unsigned JobFactory::nodeCount() const
 {
     return m_nodeTree.size();
@@ -19,16 +19,20 @@
 #ifndef JOBFACTORY_H
 #define JOBFACTORY_H
 
+#include <functional>
 #include <string>
 #include <unordered_map>
-#include <mutex>
-#include <condition_variable>
 
 #include "compileroptions.h"
+#include "depslog.h"
 #include "linkeroptions.h"
 #include "nodetree.h"
 
+class Compiler;
+class GraphCache;
 class MeiqueScript;
+class ObjectCache;
+class RemoteCache;
 class Job;
 
 class JobFactory
@@ -37,9 +41,51 @@ public:
     JobFactory(MeiqueScript& script, const StringList& targets);
     ~JobFactory();
 
+    /**
+     * Check in \p threadCount threads which objects are up to date before any job is created.
+     *
+     * Only targets not depending on custom targets or hooks are checked, since these can add or
+     * change files. Up to date objects are marked as built, the others are just compiled later.
+     */
+    void checkUpToDate(unsigned threadCount);
     Job* createJob();
     unsigned processedNodes() const { return m_processedNodes; }
     unsigned nodeCount() const;
+    /// Stop creating jobs after \p count nodes failed to build, 0 means never stop.
+    void setMaxFailures(unsigned count) { m_maxFailures = count; }
+    /**
+     * Decide if objects must be compiled by the contents of their inputs instead of their modification times.
+     *
+     * Files are only hashed when their modification time differs from the one they had when last hashed.
+     */
+    void setHashInputs(bool value) { m_hashInputs = value; }
+    /// Fetch objects from \p cache instead of compiling them when possible, and store the compiled ones there.
+    void setObjectCache(ObjectCache* cache) { m_objectCache = cache; }
+    /// Look up objects not found locally in \p cache, in the job slot of the compilation, and upload the compiled ones.
+    void setRemoteCache(RemoteCache* cache) { m_remoteCache = cache; }
+    /**
+     * Files used or written by the nodes already processed: sources, the dependencies found by the compiler,
+     * the custom target files and the outputs.
+     */
+    StringSet nodeFiles();
+    /// The files among nodeFiles() written by the build itself.
+    StringSet outputFiles();
+    /**
+     * After the build finishes, schedule the nodes using \p changedFiles and the failed ones to be processed again.
+     * Nodes using \p changedDuringBuild are built even if they look up to date, they may have used the old contents.
+     */
+    void rescheduleChangedFiles(const StringList& changedFiles, const StringList& changedDuringBuild = StringList());
+    /// Add the nodes of the build to \p graph, so the next no-op build can be detected without evaluating the project.
+    void saveGraph(GraphCache& graph);
+    /// Names of the targets not built due to failures.
+    StringList failedTargets();
+    /// Print the \p count nodes that used more CPU time in this build, compared with the previous build.
+    void printStats(unsigned count = 10);
+    /**
+     * Print the headers that would save more CPU time if precompiled for each one of \p targets, or all
+     * targets. Each compilation time is split among its source and headers by their sizes.
+     */
+    void suggestPrecompiledHeaders(const StringList& targets, unsigned count = 20);
 private:
     JobFactory(const JobFactory&) = delete;
 
@@ -47,9 +93,33 @@ private:
         std::string targetDirectory;
         CompilerOptions compilerOptions;
         LinkerOptions linkerOptions;
+        /// Header to precompile, relative to the target directory.
+        std::string precompiledHeader;
+        /// Target whose precompiled header is used instead.
+        std::string precompiledHeaderTarget;
     };
 
-    Node* findAGoodNode(Node** target, Node* node);
+    struct Compilation {
+        std::string source;
+        std::string output;
+        StringList command;
+        uint64_t commandHash;
+        std::string workingDirectory;
+        /// False for precompiled headers, too big for the object caches.
+        bool cacheable;
+        /// Shared libraries used by a link, their interface is part of the command hash.
+        StringList libraries;
+    };
+
+    Compilation prepareCompilation(Node* target, Node* node);
+    /// The link command of \p target, the source is left empty.
+    Compilation prepareLink(Node* target);
+    /// Thread safe, only looks at files and at the dependency log.
+    bool isUpToDate(const Compilation& compilation);
+    /// Thread safe, returns true if the object was copied from the object cache.
+    bool fetchFromCache(const Compilation& compilation);
+    bool canCheckEarly(Node* target);
+    void visitNodeFiles(const std::function<void(Node*, const std::string&, bool isOutput)>& visitor);
     Job* createCompilationJob(Node* target, Node* node);
     Job* createTargetJob(Node* target);
     Job* createCustomTargetJob(Node* target);
@@ -57,17 +127,28 @@ private:
     void fillTargetOptions(Node* node, Options* options);
     void mergeCompilerAndLinkerOptions(Node* node);
     void cacheTargetCompilerOptions(Node* node);
+    void setupPrecompiledHeader(Node* target);
+    void suggestPrecompiledHeader(Node* target, unsigned count);
+    void saveNodeStats();
+    bool inputsChanged(Compiler* compiler, const std::string& output);
+    void recordInputsHash(const std::string& output);
+    void setParentsShouldBuild(Node* node);
+    void setCustomTargetsShouldBuild(Node* node);
+    bool isSharedLibrary(Node* node);
+    uint64_t customTargetInputsHash(const StringList& files, const std::string& sourceDir);
+    /// Used by restat custom targets, whose outputs may be older than their inputs.
+    bool customTargetInputsChanged(const StringList& files, const std::string& sourceDir, const StringList& outputs);
 
     MeiqueScript& m_script;
     NodeTree m_nodeTree;
     Node* m_root;
 
-    bool m_needToWait;
-    std::mutex m_treeChangedMutex;
-    std::condition_variable m_treeChanged;
-    bool m_treeChangedMeanWhile;
-
     unsigned m_processedNodes;
+    unsigned m_maxFailures;
+    bool m_hashInputs;
+    ObjectCache* m_objectCache;
+    RemoteCache* m_remoteCache;
+    DepsLog m_depsLog;
 
     typedef std::unordered_map<Node*, Options*> CompilerOptionsMap;
     CompilerOptionsMap m_targetCompilerOptions;
@@ -20,83 +20,489 @@
 #include "logger.h"
 #include "job.h"
 #include "jobfactory.h"
+#include "oscommandjob.h"
+#include "os.h"
+#include "stdstringsux.h"
+#include "tracer.h"
 
-#include <functional>
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
+#include <sstream>
+
+extern "C" {
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
 
 JobManager::JobManager(JobFactory& jobFactory, unsigned maxJobRunning)
     : m_jobFactory(jobFactory)
     , m_maxJobsRunning(maxJobRunning)
     , m_jobsRunning(0)
+    , m_jobsReleasing(0)
+    , m_jobsQueued(0)
+    , m_stopWorkers(false)
+    , m_maxLoadAverage(0)
+    , m_maxMemoryPressure(0)
+    , m_memoryBudget(0)
+    , m_memoryReserved(0)
+    , m_maxFailures(1)
     , m_errorOccured(false)
+    , m_buildFailed(false)
+    , m_nextWorker(0)
 {
+    m_busySlots.resize(m_maxJobsRunning);
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeUpFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_epollFd == -1 || m_wakeUpFd == -1)
+        throw Error("Unable to create the job manager event loop.");
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeUpFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeUpFd, &event);
+
+    for (unsigned i = 0; i < m_maxJobsRunning; ++i)
+        m_workers.push_back(new Worker);
+    for (unsigned i = 0; i < m_maxJobsRunning; ++i)
+        m_workers[i]->thread = std::thread(&JobManager::workerLoop, this, i);
+    m_eventLoopThread = std::thread(&JobManager::eventLoop, this);
 }
 
 JobManager::~JobManager()
 {
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        m_stopWorkers = true;
+    }
+    m_hasJobsCond.notify_all();
+    wakeUpEventLoop();
+
+    for (Worker* worker : m_workers) {
+        worker->thread.join();
+        delete worker;
+    }
+    m_eventLoopThread.join();
+    close(m_epollFd);
+    close(m_wakeUpFd);
 }
 
-void JobManager::printReportLine(const Job* job) const
+static Manipulators reportColor(const Job* job)
 {
-    Manipulators color;
     switch (job->name().empty() ? 0 : job->name()[0]) {
     case 'C':
-        color = Green;
-        break;
+        return Green;
     case 'L':
-        color = Magenta;
-        break;
+        return Magenta;
     case 'R':
-        color = Blue;
-        break;
+        return Blue;
+    default:
+        return NoColor;
     }
+}
 
-    Notice() << '[' << m_jobFactory.processedNodes() << '/' << m_jobFactory.nodeCount() << "] " << color << job->name();
+void JobManager::printReportLine(const Job* job)
+{
+    std::lock_guard<std::mutex> lock(m_outputMutex);
+    Notice() << '[' << m_jobFactory.processedNodes() << '/' << m_jobFactory.nodeCount() << "] " << reportColor(job) << job->name();
+}
+
+void JobManager::printOutput(OSCommandJob* job)
+{
+    if (!job->hasOutput())
+        return;
+
+    // All at once, so the output of jobs finishing at the same time doesn't get mixed.
+    std::lock_guard<std::mutex> lock(m_outputMutex);
+    Notice() << reportColor(job) << job->name() << ':';
+    job->flushOutput();
 }
 
 bool JobManager::run()
 {
-    while (!m_errorOccured) {
+    m_jobFactory.checkUpToDate(m_maxJobsRunning);
+
+    while (true) {
         {
             std::unique_lock<std::mutex> lock(m_jobsRunningMutex);
-            if (m_jobsRunning >= m_maxJobsRunning)
-                m_needJobsCond.wait(lock);
+            m_needJobsCond.wait(lock, [&] { return m_jobsRunning < m_maxJobsRunning || m_errorOccured; });
+            if (m_errorOccured)
+                break;
         }
 
-        if (m_errorOccured)
-            break;
-
         Job* job = m_jobFactory.createJob();
         if (!job)
             break;
 
-        m_jobsRunningMutex.lock();
-        m_jobsRunning++;
-        m_jobsRunningMutex.unlock();
-
-        printReportLine(job);
+        if (!waitForResources(job)) {
+            delete job;
+            break;
+        }
 
-        job->onFinished = [&](int result) { onJobFinished(result); };
-        job->run();
+        // Jobs with a prelude may not compile anything, they report once it's known.
+        OSCommandJob* processJob = dynamic_cast<OSCommandJob*>(job);
+        if (!processJob || !processJob->hasPrelude())
+            printReportLine(job);
+        dispatch(job);
     }
 
     std::unique_lock<std::mutex> lock(m_jobsRunningMutex);
-    if (m_jobsRunning) {
+    if (m_jobsRunning)
         Notice() << "Waiting for unfinished jobs...";
-        m_allDoneCond.wait(lock);
+    m_needJobsCond.wait(lock, [&] { return !m_jobsRunning && !m_jobsReleasing; });
+    const bool buildFailed = m_buildFailed;
+    lock.unlock();
+
+    // With a single failure allowed the summary would just repeat the last error.
+    if (m_maxFailures != 1 && !m_failedJobs.empty())
+        printFailureSummary();
+    return m_failedJobs.empty() && !buildFailed;
+}
+
+void JobManager::setMaxFailures(unsigned count)
+{
+    m_maxFailures = count;
+    m_jobFactory.setMaxFailures(count);
+}
+
+void JobManager::printFailureSummary()
+{
+    Notice() << Red << m_failedJobs.size() << (m_failedJobs.size() == 1 ? " job" : " jobs") << " failed:";
+    for (const std::string& name : m_failedJobs)
+        Notice() << "    " << name;
+
+    StringList targets = m_jobFactory.failedTargets();
+    if (!targets.empty())
+        Notice() << Red << "Targets not built: " << join(targets, ", ");
+}
+
+bool JobManager::waitForResources(Job* job)
+{
+    std::unique_lock<std::mutex> lock(m_jobsRunningMutex);
+    // If nothing is running there's no one to free resources, so the job is started anyway.
+    if (m_jobsRunning && !m_errorOccured && !hasResourcesFor(job)) {
+        Debug() << "Waiting for system resources to start " << job->name();
+        do {
+            // Load and memory pressure can drop without any job finishing, so check them again from time to time.
+            m_needJobsCond.wait_for(lock, std::chrono::milliseconds(100));
+        } while (m_jobsRunning && !m_errorOccured && !hasResourcesFor(job));
+    }
+    if (m_errorOccured)
+        return false;
+
+    m_memoryReserved += job->expectedPeakMemory();
+    return true;
+}
+
+bool JobManager::hasResourcesFor(const Job* job) const
+{
+    if (m_maxLoadAverage > 0 && OS::loadAverage() > m_maxLoadAverage)
+        return false;
+    if (m_maxMemoryPressure > 0 && OS::memoryPressure() > m_maxMemoryPressure)
+        return false;
+    return !m_memoryBudget || m_memoryReserved + job->expectedPeakMemory() <= m_memoryBudget;
+}
+
+void JobManager::dispatch(Job* job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        m_jobsRunning++;
+        auto slot = std::find(m_busySlots.begin(), m_busySlots.end(), false);
+        *slot = true;
+        job->setSlot(slot - m_busySlots.begin());
+    }
+
+    // External processes don't need a thread, just watch them, unless there's a prelude to run.
+    OSCommandJob* processJob = dynamic_cast<OSCommandJob*>(job);
+    if (processJob && !processJob->hasPrelude()) {
+        startProcess(processJob);
+        return;
+    }
+    queueJob(job);
+}
+
+void JobManager::queueJob(Job* job)
+{
+    Worker* worker;
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        worker = m_workers[m_nextWorker];
+        m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->jobs.push_back(job);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        m_jobsQueued++;
+    }
+    m_hasJobsCond.notify_one();
+}
+
+Job* JobManager::takeJob(unsigned workerId)
+{
+    // The caller already claimed one of the queued jobs, so it's somewhere, keep looking until we find it.
+    const unsigned numWorkers = m_workers.size();
+    while (true) {
+        // Our own jobs are taken from the back...
+        Worker* worker = m_workers[workerId];
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            if (!worker->jobs.empty()) {
+                Job* job = worker->jobs.back();
+                worker->jobs.pop_back();
+                return job;
+            }
+        }
+        // ...and the stolen ones from the front.
+        for (unsigned i = 1; i < numWorkers; ++i) {
+            Worker* victim = m_workers[(workerId + i) % numWorkers];
+            std::lock_guard<std::mutex> lock(victim->mutex);
+            if (!victim->jobs.empty()) {
+                Job* job = victim->jobs.front();
+                victim->jobs.pop_front();
+                return job;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void JobManager::workerLoop(unsigned workerId)
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_jobsRunningMutex);
+            m_hasJobsCond.wait(lock, [&] { return m_jobsQueued || m_stopWorkers; });
+            if (!m_jobsQueued)
+                return;
+            m_jobsQueued--;
+        }
+
+        Job* job = takeJob(workerId);
+        OSCommandJob* processJob = dynamic_cast<OSCommandJob*>(job);
+        if (processJob && processJob->hasExited()) {
+            processJob->finish();
+        } else if (processJob) {
+            const bool done = processJob->runPrelude();
+            printReportLine(job);
+            if (!done) {
+                startProcess(processJob);
+                continue;
+            }
+        } else {
+            job->run();
+        }
+        onJobFinished(job);
+    }
+}
+
+void JobManager::startProcess(OSCommandJob* job)
+{
+    // Running in a worker thread, errors must fail the job instead of escaping it.
+    bool started;
+    try {
+        started = job->start();
+    } catch (const Error& e) {
+        std::lock_guard<std::mutex> lock(m_outputMutex);
+        e.show();
+        started = false;
+    }
+    if (!started) {
+        job->setExitStatus(127, OS::ResourceUsage());
+        job->finish();
+        onJobFinished(job);
+        return;
+    }
+
+    Process* process = new Process;
+    process->job = job;
+    process->pidFd = OS::processFd(job->pid());
+
+    std::lock_guard<std::mutex> lock(m_processesMutex);
+    watchFd(job->outputFd(), process);
+    watchFd(job->errorFd(), process);
+    if (process->pidFd != -1) {
+        watchFd(process->pidFd, process);
+    } else {
+        m_polledProcesses.push_back(process);
+        wakeUpEventLoop();
+    }
+}
+
+void JobManager::eventLoop()
+{
+    const int maxEvents = 64;
+    epoll_event events[maxEvents];
+
+    while (true) {
+        bool polling;
+        {
+            std::lock_guard<std::mutex> lock(m_processesMutex);
+            polling = !m_polledProcesses.empty();
+        }
+
+        // Waking up from time to time, so it still stops if a wake up fails.
+        int numEvents = epoll_wait(m_epollFd, events, maxEvents, polling ? 10 : 1000);
+        {
+            std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+            if (m_stopWorkers)
+                return;
+        }
+        for (int i = 0; i < numEvents; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wakeUpFd) {
+                uint64_t value;
+                if (read(m_wakeUpFd, &value, sizeof(value)) < 0 && errno != EAGAIN && errno != EINTR)
+                    failBuild("Error reading job manager event loop events.");
+                continue;
+            }
+
+            Process* process;
+            {
+                std::lock_guard<std::mutex> lock(m_processesMutex);
+                auto it = m_processFds.find(fd);
+                // The process was already reaped by a previous event.
+                if (it == m_processFds.end())
+                    continue;
+                process = it->second;
+            }
+
+            if (fd == process->pidFd) {
+                reapProcess(process);
+            } else if (!process->job->readOutput(fd)) {
+                std::lock_guard<std::mutex> lock(m_processesMutex);
+                unwatchFd(fd);
+            }
+        }
+
+        if (polling) {
+            std::list<Process*> processes;
+            {
+                std::lock_guard<std::mutex> lock(m_processesMutex);
+                processes = m_polledProcesses;
+            }
+            for (Process* process : processes)
+                reapProcess(process);
+        }
     }
+}
 
-    return !m_errorOccured;
+void JobManager::wakeUpEventLoop()
+{
+    uint64_t value = 1;
+    if (write(m_wakeUpFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        failBuild("Error waking up the job manager event loop.");
 }
 
-void JobManager::onJobFinished(int result)
+void JobManager::failBuild(const std::string& message)
 {
-    std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
-    m_jobsRunning--;
-    if (result)
+    {
+        std::lock_guard<std::mutex> lock(m_outputMutex);
+        Error(message).show();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
         m_errorOccured = true;
-    if (m_jobsRunning < m_maxJobsRunning)
-        m_needJobsCond.notify_all();
-    if (m_jobsRunning == 0)
-        m_allDoneCond.notify_all();
+        m_buildFailed = true;
+    }
+    m_needJobsCond.notify_all();
+}
+
+void JobManager::watchFd(int fd, Process* process)
+{
+    m_processFds[fd] = process;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void JobManager::unwatchFd(int fd)
+{
+    if (m_processFds.erase(fd))
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, 0);
+}
+
+void JobManager::reapProcess(Process* process)
+{
+    OSCommandJob* job = process->job;
+    int status;
+    OS::ResourceUsage usage;
+    int pid = OS::waitProcess(job->pid(), &status, &usage, false);
+
+    // Not finished yet.
+    if (!pid)
+        return;
+    if (pid == -1)
+        status = 1;
+    else
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    {
+        std::lock_guard<std::mutex> lock(m_processesMutex);
+        unwatchFd(job->outputFd());
+        unwatchFd(job->errorFd());
+        if (process->pidFd != -1) {
+            unwatchFd(process->pidFd);
+            close(process->pidFd);
+        } else {
+            m_polledProcesses.remove(process);
+        }
+    }
+    delete process;
+
+    // The success callback may do a lot of IO, e.g. storing the outputs in the object cache, so the
+    // job is finished by a worker and the event loop goes on watching the other processes.
+    job->setExitStatus(status, usage);
+    queueJob(job);
+}
+
+void JobManager::onJobFinished(Job* job)
+{
+    OSCommandJob* processJob = dynamic_cast<OSCommandJob*>(job);
+    if (processJob)
+        printOutput(processJob);
+
+    int result = job->result();
+    int slot = job->slot();
+    std::string name = job->name();
+    unsigned long peakMemory = job->expectedPeakMemory();
+    if (Tracer::isEnabled()) {
+        StringMap args;
+        args["target"] = job->targetName();
+        args["node"] = job->nodeName();
+        std::ostringstream status;
+        status << result;
+        args["status"] = status.str();
+        Tracer::addEvent(job->name(), processJob ? "process" : "lua", job->startTime(), job->finishTime(), slot, args);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        m_jobsRunning--;
+        m_jobsReleasing++;
+        m_busySlots[slot] = false;
+        m_memoryReserved -= peakMemory;
+        if (result) {
+            m_failedJobs.push_back(name);
+            if (m_maxFailures && m_failedJobs.size() >= m_maxFailures)
+                m_errorOccured = true;
+        }
+    }
+
+    // Deleting the job releases its node, so the JobFactory can see the tree change. It's done after
+    // the job stopped counting as running, so the last job doesn't look unfinished when the build ends.
+    delete job;
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobsRunningMutex);
+        m_jobsReleasing--;
+    }
+    m_needJobsCond.notify_all();
 }
@@ -21,31 +21,118 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <list>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "basictypes.h"
 
 class Job;
 class JobFactory;
-class JobQueue;
+class OSCommandJob;
 
+/**
+ * Dispatch jobs created by the JobFactory.
+ *
+ * Jobs running external processes are spawned by the JobManager and watched by a single
+ * event loop using epoll, on Linux the process exit is noticed via a pidfd. Once the process
+ * exits the job is finished by a worker, so its success callback doesn't block the event loop.
+ *
+ * Other jobs run on a fixed pool of worker threads, each worker has its own deque of jobs,
+ * jobs are distributed in a round robin fashion and idle workers steal jobs from the front
+ * of other workers deques.
+ */
 class JobManager
 {
 public:
     JobManager(JobFactory& jobFactory, unsigned maxJobRunning);
     ~JobManager();
 
+    /// Don't start new jobs while the system load average is above \p load, 0 disables it.
+    void setMaxLoadAverage(double load) { m_maxLoadAverage = load; }
+    /// Don't start new jobs while the memory pressure is above \p pressure percent, 0 disables it.
+    void setMaxMemoryPressure(double pressure) { m_maxMemoryPressure = pressure; }
+    /**
+     * Only start a job if the peak memory it used in the last build plus the peak memory of the
+     * jobs already running fits in \p budget KiB, 0 disables it.
+     */
+    void setMemoryBudget(unsigned long budget) { m_memoryBudget = budget; }
+    /// Stop dispatching jobs after \p count jobs failed, 0 means never stop.
+    void setMaxFailures(unsigned count);
+
     bool run();
 private:
+    struct Worker {
+        std::deque<Job*> jobs;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    struct Process {
+        OSCommandJob* job;
+        int pidFd;
+    };
+
     JobFactory& m_jobFactory;
 
     unsigned m_maxJobsRunning;
     unsigned m_jobsRunning;
+    /// Jobs already finished but still releasing their nodes.
+    unsigned m_jobsReleasing;
+    unsigned m_jobsQueued;
+    /// Job slots in use, used to show what each of the -j jobs is doing in traces.
+    std::vector<bool> m_busySlots;
+    bool m_stopWorkers;
     std::mutex m_jobsRunningMutex;
 
+    double m_maxLoadAverage;
+    double m_maxMemoryPressure;
+    unsigned long m_memoryBudget;
+    unsigned long m_memoryReserved;
+
+    unsigned m_maxFailures;
+    StringList m_failedJobs;
+    // Too many jobs failed, stop dispatching new ones.
     bool m_errorOccured;
+    // The job manager itself failed, the build fails even without failed jobs.
+    bool m_buildFailed;
     std::condition_variable m_needJobsCond;
-    std::condition_variable m_allDoneCond;
+    std::condition_variable m_hasJobsCond;
+
+    std::vector<Worker*> m_workers;
+    unsigned m_nextWorker;
+
+    int m_epollFd;
+    int m_wakeUpFd;
+    std::thread m_eventLoopThread;
+    std::mutex m_processesMutex;
+    std::unordered_map<int, Process*> m_processFds;
+    // Processes without a pidfd, checked from time to time.
+    std::list<Process*> m_polledProcesses;
+
+    // Serializes the output of the job reports and of the jobs themselves.
+    std::mutex m_outputMutex;
 
-    void printReportLine(const Job*) const;
-    void onJobFinished(int result);
+    void printReportLine(const Job* job);
+    void printOutput(OSCommandJob* job);
+    void printFailureSummary();
+    bool waitForResources(Job* job);
+    bool hasResourcesFor(const Job* job) const;
+    void dispatch(Job* job);
+    /// Queue \p job to be run by a worker, or finished if its process already exited.
+    void queueJob(Job* job);
+    Job* takeJob(unsigned workerId);
+    void workerLoop(unsigned workerId);
+    void startProcess(OSCommandJob* job);
+    void eventLoop();
+    void wakeUpEventLoop();
+    /// Show \p message and stop the build, used on errors in threads where an exception can't be thrown.
+    void failBuild(const std::string& message);
+    void watchFd(int fd, Process* process);
+    void unwatchFd(int fd);
+    void reapProcess(Process* process);
+    void onJobFinished(Job* job);
 
     JobManager(const JobManager&) = delete;
 };
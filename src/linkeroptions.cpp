@@ -57,13 +57,3 @@ void LinkerOptions::merge(const LinkerOptions& other)
     copy(m_libraryPaths, other.m_libraryPaths);
     copy(m_customFlags, other.m_customFlags);
 }
-
-std::string LinkerOptions::hash() const
-{
-    return join(m_libraries, ":") + ','
-           + join(m_staticLibraries, ":") + ','
-           + join(m_libraryPaths, ":") + ','
-           + join(m_customFlags, ":") + ','
-           + char('0' + m_linkType) + ','
-           + char('0' + m_language) + ',';
-}
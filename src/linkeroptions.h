@@ -48,7 +48,6 @@ public:
     Language language() const { return m_language; }
 
     void merge(const LinkerOptions& other);
-    std::string hash() const;
 private:
     StringList m_libraries;
     StringList m_staticLibraries;
@@ -93,6 +93,12 @@ inline int lua_tocpp<int>(lua_State* L, int index)
     return lua_tointeger(L, index);
 }
 
+template<>
+inline unsigned long lua_tocpp<unsigned long>(lua_State* L, int index)
+{
+    return lua_tonumber(L, index);
+}
+
 template<>
 inline bool lua_tocpp<bool>(lua_State* L, int index)
 {
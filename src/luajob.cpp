@@ -56,12 +56,15 @@ int LuaJob::doRun()
     for (int i = 1; i <= objlen; ++i)
         lua_rawgeti(m_L, -i, objlen - i + 1);
 
+    // Lua code can write any file, so forget all cached file metadata.
     try {
         LuaAutoPop autoPop(m_L, 2);
         luaPCall(m_L, objlen - 1, 0);
     } catch (const Error& e) {
+        OS::invalidateFileInfo();
         e.show();
         return 1;
     }
+    OS::invalidateFileInfo();
     return 0;
 }
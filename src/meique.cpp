@@ -23,19 +23,32 @@
 #include "compilerfactory.h"
 #include "jobmanager.h"
 #include "jobfactory.h"
+#include "filewatcher.h"
+#include "buildserver.h"
+#include "depslog.h"
+#include "graphcache.h"
 #include "meiqueversion.h"
+#include "objectcache.h"
+#include "remotecache.h"
 #include <vector>
 #include <sstream>
 #include "statemachine.h"
 #include "meiquecache.h"
+#include "tracer.h"
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
+#include <memory>
+#include <unistd.h>
 
 #define MEIQUECACHE "meiquecache.lua"
+#define MEIQUEGRAPH "meiquegraph.bin"
+#define MEIQUEDEPS "meiquedeps.bin"
 
 enum {
     HasVersionArg = 1,
     HasHelpArg,
+    HasCacheStatsArg,
     NormalArgs,
     DumpProject,
     Found,
@@ -47,11 +60,19 @@ enum {
     InstallAction,
     UninstallAction,
     BuildAction,
-    CleanAction
+    CleanAction,
+    SuggestPchAction,
+    Restart,
+    UseBuildServer,
+    StartBuildServer
 };
 
+// Minutes without requests before the build server exits.
+static const int DefaultServerIdleTimeout = 30;
+
 Meique::Meique(int argc, const char** argv)
     : m_args(argc, argv)
+    , m_commandLine(argv + 1, argv + argc)
     , m_script(nullptr)
     , m_firstRun(false)
 {
@@ -60,6 +81,7 @@ Meique::Meique(int argc, const char** argv)
 Meique::~Meique()
 {
     delete m_script;
+    Tracer::save();
 }
 
 int Meique::checkArgs()
@@ -70,10 +92,18 @@ int Meique::checkArgs()
 
     if (m_args.boolArg("d"))
         ::coloredOutputEnabled = false;
+    if (m_args.boolArg("trace")) {
+        std::string traceFile = m_args.arg("trace");
+        if (traceFile.empty())
+            throw Error("You should use a file name in --trace option, e.g. --trace=trace.json.");
+        Tracer::enable(OS::normalizeFilePath(traceFile));
+    }
     if (m_args.boolArg("version"))
         return HasVersionArg;
     if (m_args.boolArg("help"))
         return HasHelpArg;
+    if (m_args.boolArg("cache-stats"))
+        return HasCacheStatsArg;
     if (m_args.boolArg("meique-dump-project"))
         return DumpProject;
     return NormalArgs;
@@ -82,7 +112,19 @@ int Meique::checkArgs()
 int Meique::lookForMeiqueCache()
 {
     std::ifstream file(MEIQUECACHE);
-    return file ? Found : NotFound;
+    if (!file)
+        return NotFound;
+
+    // Only plain builds are handled by the build server.
+    if (m_args.boolArg("server") && isPlainBuild())
+        return UseBuildServer;
+    return Found;
+}
+
+bool Meique::isPlainBuild() const
+{
+    return !m_args.boolArg("c") && !m_args.boolArg("i") && !m_args.boolArg("t") && !m_args.boolArg("u") && !m_args.boolArg("watch")
+        && !m_args.boolArg("suggest-pch");
 }
 
 int Meique::lookForMeiqueLua()
@@ -98,6 +140,8 @@ int Meique::configureProject()
     std::string meiqueLuaPath = OS::normalizeDirPath(m_args.freeArg(0));
     m_script = new MeiqueScript(meiqueLuaPath + "/meique.lua", &m_args);
     m_firstRun = true;
+    // The options may have changed, so the project must be evaluated on the next build.
+    GraphCache(MEIQUEGRAPH).remove();
 
     try {
         m_script->exec();
@@ -127,12 +171,27 @@ int Meique::dumpProject()
 int Meique::getBuildAction()
 {
     if (!m_script) {
+        // No-op builds don't need to evaluate the project at all.
+        if (isPlainBuild() && !m_args.boolArg("hash-inputs")) {
+            GraphCache graph(MEIQUEGRAPH);
+            if (graph.load(getChosenTargetNames())) {
+                DepsLog depsLog;
+                depsLog.open(MEIQUEDEPS);
+                if (graph.isBuildUpToDate(depsLog)) {
+                    Debug() << "Nothing to build.";
+                    return 0;
+                }
+            }
+        }
+
         m_script = new MeiqueScript;
         m_script->exec();
     }
 
     if (m_args.boolArg("c"))
         return CleanAction;
+    else if (m_args.boolArg("suggest-pch"))
+        return SuggestPchAction;
     else if (m_args.boolArg("i"))
         return InstallAction;
     else if (m_args.boolArg("t"))
@@ -152,26 +211,273 @@ StringList Meique::getChosenTargetNames()
     return targetNames;
 }
 
-int Meique::buildTargets()
+bool Meique::runJobs(JobFactory& jobFactory, const CmdLine& args)
 {
-    int jobLimit = m_args.intArg("j", OS::numberOfCPUCores() + 1);
+    int jobLimit = args.intArg("j", OS::numberOfCPUCores() + 1);
     if (jobLimit <= 0)
         throw Error("You should use a number greater than zero in -j option.");
 
-    JobFactory jobFactory(*m_script, getChosenTargetNames());
+    int maxFailures = args.intArg("k", 1);
+    if (maxFailures < 0)
+        throw Error("You should use a number greater than or equal to zero in -k option.");
+    int loadLimit = args.intArg("l", 0);
+    if (loadLimit < 0)
+        throw Error("You should use a number greater than or equal to zero in -l option.");
+    int memoryPressureLimit = args.intArg("max-memory-pressure", 10);
+    if (memoryPressureLimit < 0)
+        throw Error("You should use a number greater than or equal to zero in --max-memory-pressure option.");
+
+    // The budget is given in MiB, defaulting to all memory available now.
+    bool hasMemoryBudget;
+    std::string memoryBudgetArg = args.arg("memory-budget", std::string(), &hasMemoryBudget);
+    unsigned long memoryBudget = 0;
+    if (hasMemoryBudget) {
+        memoryBudget = memoryBudgetArg.empty() ? OS::availableMemory() : std::strtoul(memoryBudgetArg.c_str(), 0, 10) * 1024;
+        if (!memoryBudget)
+            throw Error("Unable to determine the memory budget, use --memory-budget=MiB.");
+    }
+
+    // The cache statistics are saved when it's destroyed.
+    ObjectCache objectCache(ObjectCache::defaultDirectory(), ObjectCache::defaultMaxSize());
+    jobFactory.setObjectCache(args.boolArg("cache") ? &objectCache : nullptr);
+    // Destroyed after the job manager, waiting for the uploads of what was compiled.
+    std::unique_ptr<RemoteCache> remoteCache;
+    if (args.boolArg("remote-cache")) {
+        const std::string url = args.arg("remote-cache");
+        if (url.empty())
+            throw Error("You should use an URL in --remote-cache option, e.g. --remote-cache=http://host:port.");
+        remoteCache.reset(new RemoteCache(url));
+    }
+    jobFactory.setRemoteCache(remoteCache.get());
+
+    jobFactory.setHashInputs(args.boolArg("hash-inputs"));
     JobManager jobManager(jobFactory, jobLimit);
-    if (!jobManager.run())
-        throw Error("Build error.");
+    jobManager.setMaxLoadAverage(loadLimit);
+    jobManager.setMaxMemoryPressure(memoryPressureLimit);
+    jobManager.setMemoryBudget(memoryBudget);
+    jobManager.setMaxFailures(maxFailures);
+    bool success = jobManager.run();
+    jobFactory.setObjectCache(nullptr);
+    jobFactory.setRemoteCache(nullptr);
+    if (args.boolArg("stats"))
+        jobFactory.printStats();
+    return success;
+}
 
+StringSet Meique::projectFiles()
+{
+    StringSet projectFiles;
+    for (const std::string& file : m_script->projectFiles())
+        projectFiles.insert(OS::normalizeFilePath(m_script->sourceDir() + file));
+    return projectFiles;
+}
+
+// Returns the files that weren't watched yet.
+static StringList watchFiles(FileWatcher& watcher, JobFactory& jobFactory, const StringSet& projectFiles)
+{
+    StringList newFiles;
+    for (const std::string& file : projectFiles) {
+        if (watcher.addFile(file))
+            newFiles.push_back(file);
+    }
+    for (const std::string& file : jobFactory.nodeFiles()) {
+        if (watcher.addFile(file))
+            newFiles.push_back(file);
+    }
+    return newFiles;
+}
+
+// Files changed while building, without the ones written by the build itself. The cached metadata of all is dropped.
+static StringList changesDuringBuild(FileWatcher& watcher, JobFactory& jobFactory)
+{
+    StringList changedFiles = watcher.pendingChanges();
+    if (changedFiles.empty())
+        return changedFiles;
+
+    const StringSet outputs = jobFactory.outputFiles();
+    StringList externalChanges;
+    for (const std::string& file : changedFiles) {
+        OS::invalidateFileInfo(file);
+        if (!outputs.count(file))
+            externalChanges.push_back(file);
+    }
+    return externalChanges;
+}
+
+int Meique::buildTargets()
+{
+    // Files are only written by jobs during the build, so their metadata can be cached.
+    OS::FileInfoCacheScope fileInfoCache;
+    JobFactory jobFactory(*m_script, getChosenTargetNames());
+    // The build changes what the snapshot describes, an interrupted build must not leave the old one behind.
+    GraphCache graph(m_script->buildDir() + MEIQUEGRAPH);
+    graph.remove();
+
+    // Tests run after the build, so there's no watch mode for them.
+    if (!m_args.boolArg("watch") || m_args.boolArg("t")) {
+        if (!runJobs(jobFactory, m_args))
+            throw Error("Build error.");
+        for (const std::string& file : projectFiles())
+            graph.addProjectFile(file);
+        jobFactory.saveGraph(graph);
+        graph.save(getChosenTargetNames());
+        return 0;
+    }
+
+    // Watching before building, so files saved during the build aren't missed. Changes to files found by the
+    // first build are only seen if their directory was already watched, events are filtered when read.
+    const StringSet projectFiles = this->projectFiles();
+    FileWatcher watcher;
+    watchFiles(watcher, jobFactory, projectFiles);
+    runJobs(jobFactory, m_args);
+
+    // The project files can change anything, on changes the build starts again from scratch.
+    while (true) {
+        watchFiles(watcher, jobFactory, projectFiles);
+        const StringList changedDuringBuild = changesDuringBuild(watcher, jobFactory);
+        StringList changedFiles;
+        if (changedDuringBuild.empty()) {
+            Notice() << "Watching for changes...";
+            changedFiles = watcher.waitForChanges();
+        }
+        for (const std::string& file : changedDuringBuild.empty() ? changedFiles : changedDuringBuild) {
+            if (projectFiles.count(file)) {
+                Notice() << "Project file " << file << " changed, restarting.";
+                return Restart;
+            }
+        }
+
+        OS::invalidateFileInfo();
+        jobFactory.rescheduleChangedFiles(changedFiles, changedDuringBuild);
+        runJobs(jobFactory, m_args);
+    }
+}
+
+int Meique::requestBuild()
+{
+    int fd = BuildServer::connect();
+    if (fd == -1)
+        return StartBuildServer;
+
+    BuildServer::sendRequest(fd, m_commandLine);
+    std::string errorMessage;
+    bool success = BuildServer::receiveResult(fd, errorMessage);
+    close(fd);
+    if (!success)
+        throw Error(errorMessage);
+    return 0;
+}
+
+int Meique::runBuildServer()
+{
+    BuildServer server;
+    // Another client may have started a server meanwhile.
+    if (!server.isListening())
+        return 0;
+
+    const std::string idleTimeoutArg = m_args.arg("server");
+    const int idleTimeout = idleTimeoutArg.empty() ? DefaultServerIdleTimeout : std::atoi(idleTimeoutArg.c_str());
+    Debug() << "Build server started, idle timeout of " << idleTimeout << " minutes.";
+
+    // The sources and the project files are watched, so the metadata of other files stay valid between builds.
+    OS::FileInfoCacheScope fileInfoCache;
+    std::unique_ptr<JobFactory> jobFactory;
+    StringList jobFactoryTargets;
+    FileWatcher watcher;
+    StringSet projectFiles;
+    // Files changed during the last build, rebuilt by the next request.
+    StringList changedDuringBuild;
+
+    BuildServer::Request request;
+    while (server.waitForRequest(idleTimeout * 60 * 1000, request)) {
+        server.beginRequest(request);
+        bool success = false;
+        std::string errorMessage;
+        try {
+            std::vector<const char*> argv(1, "meique");
+            for (const std::string& arg : request.args)
+                argv.push_back(arg.c_str());
+            CmdLine args(argv.size(), argv.data());
+            ::verbosityLevel = request.verbosityLevel;
+            ::coloredOutputEnabled = !args.boolArg("d");
+
+            StringList changedFiles = watcher.pendingChanges();
+            changedFiles.insert(changedFiles.end(), changedDuringBuild.begin(), changedDuringBuild.end());
+            for (const std::string& file : changedFiles) {
+                OS::invalidateFileInfo(file);
+                if (projectFiles.count(file) && m_script) {
+                    Notice() << "Project file " << file << " changed, reloading the project.";
+                    jobFactory.reset();
+                    delete m_script;
+                    m_script = nullptr;
+                }
+            }
+
+            if (!m_script) {
+                m_script = new MeiqueScript;
+                m_script->exec();
+                projectFiles = this->projectFiles();
+            }
+
+            StringList targets;
+            for (int i = 0; i < args.numberOfFreeArgs(); ++i)
+                targets.push_back(args.freeArg(i));
+            if (!jobFactory || targets != jobFactoryTargets) {
+                jobFactory.reset();
+                jobFactory.reset(new JobFactory(*m_script, targets));
+                jobFactoryTargets = targets;
+            } else {
+                jobFactory->rescheduleChangedFiles(changedFiles, changedDuringBuild);
+            }
+            changedDuringBuild.clear();
+
+            // Watching before building, so files saved during the build are rebuilt by the next request.
+            watchFiles(watcher, *jobFactory, projectFiles);
+            // Builds from the server never save a snapshot, the one left by other builds gets outdated.
+            GraphCache(MEIQUEGRAPH).remove();
+            success = runJobs(*jobFactory, args);
+            if (!success)
+                errorMessage = "Build error.";
+
+            // Changes to the files found by the build may not have been seen, their metadata can't be trusted.
+            for (const std::string& file : watchFiles(watcher, *jobFactory, projectFiles))
+                OS::invalidateFileInfo(file);
+            changedDuringBuild = changesDuringBuild(watcher, *jobFactory);
+        } catch (const Error& e) {
+            errorMessage = e.description();
+            // Probably an error in the project files, load them again in the next request.
+            if (!jobFactory) {
+                delete m_script;
+                m_script = nullptr;
+            }
+        }
+        server.finishRequest(request, success, errorMessage);
+    }
+    Debug() << "Build server idle for " << idleTimeout << " minutes, exiting.";
     return 0;
 }
 
+int Meique::restart()
+{
+    delete m_script;
+    m_script = nullptr;
+    return getBuildAction();
+}
+
 int Meique::cleanTargets()
 {
     m_script->cleanTargets(getChosenTargetNames());
     return 0;
 }
 
+int Meique::suggestPrecompiledHeaders()
+{
+    const StringList targets = getChosenTargetNames();
+    JobFactory jobFactory(*m_script, targets);
+    jobFactory.suggestPrecompiledHeaders(targets);
+    return 0;
+}
+
 int Meique::installTargets()
 {
     m_script->installTargets(getChosenTargetNames());
@@ -254,11 +560,15 @@ void Meique::exec()
 
     machine[STATE(Meique::checkArgs)][HasHelpArg] = STATE(Meique::showHelp);
     machine[STATE(Meique::checkArgs)][HasVersionArg] = STATE(Meique::showVersion);
+    machine[STATE(Meique::checkArgs)][HasCacheStatsArg] = STATE(Meique::showCacheStats);
     machine[STATE(Meique::checkArgs)][NormalArgs] = STATE(Meique::lookForMeiqueCache);
     machine[STATE(Meique::checkArgs)][DumpProject] = STATE(Meique::dumpProject);
 
     machine[STATE(Meique::lookForMeiqueCache)][Found] = STATE(Meique::getBuildAction);
     machine[STATE(Meique::lookForMeiqueCache)][NotFound] = STATE(Meique::lookForMeiqueLua);
+    machine[STATE(Meique::lookForMeiqueCache)][UseBuildServer] = STATE(Meique::requestBuild);
+
+    machine[STATE(Meique::requestBuild)][StartBuildServer] = STATE(Meique::runBuildServer);
 
     machine[STATE(Meique::lookForMeiqueLua)][Found] = STATE(Meique::configureProject);
     machine[STATE(Meique::lookForMeiqueLua)][NotFound] = STATE(Meique::showHelp);
@@ -270,6 +580,10 @@ void Meique::exec()
     machine[STATE(Meique::getBuildAction)][UninstallAction] = STATE(Meique::uninstallTargets);
     machine[STATE(Meique::getBuildAction)][BuildAction] = STATE(Meique::buildTargets);
     machine[STATE(Meique::getBuildAction)][CleanAction] = STATE(Meique::cleanTargets);
+    machine[STATE(Meique::getBuildAction)][SuggestPchAction] = STATE(Meique::suggestPrecompiledHeaders);
+
+    machine[STATE(Meique::buildTargets)][Restart] = STATE(Meique::restart);
+    machine[STATE(Meique::restart)][BuildAction] = STATE(Meique::buildTargets);
 
     machine.execute(STATE(Meique::checkArgs));
 }
@@ -281,6 +595,12 @@ int Meique::showVersion()
     return 0;
 }
 
+int Meique::showCacheStats()
+{
+    ObjectCache(ObjectCache::defaultDirectory(), ObjectCache::defaultMaxSize()).printStats(std::cout);
+    return 0;
+}
+
 int Meique::showHelp()
 {
     std::cout << "Usage: meique OPTIONS TARGET\n\n";
@@ -289,14 +609,44 @@ int Meique::showHelp()
     std::cout << "General options:\n";
     std::cout << " --help                             Print this message and exit.\n";
     std::cout << " --version                          Print the version number of meique and exit.\n";
+    std::cout << " --cache-stats                      Print the object cache statistics and exit.\n";
     std::cout << "Config mode options for this project:\n";
     std::cout << " --debug                            Create a debug build.\n";
     std::cout << " --release                          Create a release build.\n";
     std::cout << " --install-prefix                   Install directory used by install, this directory\n";
     std::cout << "                                    is prepended onto all install directories.\n";
+    std::cout << " --relocatable                      Don't write the source and build directories into\n";
+    std::cout << "                                    the objects, so other checkouts of the project\n";
+    std::cout << "                                    can reuse them from the object caches.\n";
     std::cout << "Build mode options:\n";
     std::cout << " -jN                                Allow N jobs at once, default to number of\n";
     std::cout << "                                    cores + 1.\n";
+    std::cout << " -kN                                Keep going until N jobs fail, 0 means never\n";
+    std::cout << "                                    stop, default to 1.\n";
+    std::cout << " -lN                                Don't start new jobs if the load average is\n";
+    std::cout << "                                    greater than N.\n";
+    std::cout << " --max-memory-pressure=N            Don't start new jobs while tasks were stalled\n";
+    std::cout << "                                    waiting for memory more than N% of the last 10\n";
+    std::cout << "                                    seconds, default to 10, 0 disables it.\n";
+    std::cout << " --memory-budget[=MiB]              Only start a job if the memory it used in the\n";
+    std::cout << "                                    last build fits in the budget, default to the\n";
+    std::cout << "                                    memory available when the build starts.\n";
+    std::cout << " --hash-inputs                      Only compile files whose contents, or the contents\n";
+    std::cout << "                                    of their dependencies, changed since the last build.\n";
+    std::cout << " --cache                            Fetch objects from the object cache instead of\n";
+    std::cout << "                                    compiling them when possible, and store the\n";
+    std::cout << "                                    compiled ones there.\n";
+    std::cout << " --remote-cache=URL                 Also look up objects in a remote cache, uploading\n";
+    std::cout << "                                    the compiled ones, see meique-cache-server.\n";
+    std::cout << " --trace=FILE                       Write a trace of the build to FILE, it can be\n";
+    std::cout << "                                    loaded in chrome://tracing.\n";
+    std::cout << " --stats                            Print the jobs that used more CPU time and how\n";
+    std::cout << "                                    they changed since the previous build.\n";
+    std::cout << " --watch                            After the build, keep watching the source files\n";
+    std::cout << "                                    and rebuild what depends on them when they change.\n";
+    std::cout << " --server[=MINUTES]                 Build using a build server that keeps the project\n";
+    std::cout << "                                    loaded, starting it if needed. The server exits\n";
+    std::cout << "                                    after MINUTES without builds, default to 30.\n";
     std::cout << " -d                                 Disable colored output\n";
     std::cout << " -s                                 Stop after configure step.\n";
     std::cout << " -c [target [, target2 [, ...]]]    Clean a specific target or all targets if\n";
@@ -307,6 +657,9 @@ int Meique::showHelp()
     std::cout << "                                    none was specified.\n";
     std::cout << " -t [regex]                         Run tests matching a regular expression, all\n";
     std::cout << "                                    tests if none was specified.\n";
+    std::cout << " --suggest-pch [target [, ...]]     Suggest a precompiled header for the targets,\n";
+    std::cout << "                                    based on the last build, or for all targets if\n";
+    std::cout << "                                    none was specified.\n";
     return 0;
 }
 
@@ -20,6 +20,7 @@
 #define MEIQUE_H
 #include "cmdline.h"
 
+class JobFactory;
 class MeiqueScript;
 
 class Meique
@@ -30,16 +31,21 @@ public:
     void exec();
 private:
     CmdLine m_args;
+    StringList m_commandLine;
     MeiqueScript* m_script;
     bool m_firstRun;
 
     StringList getChosenTargetNames();
     void printOptionsSummary();
+    bool runJobs(JobFactory& jobFactory, const CmdLine& args);
+    StringSet projectFiles();
+    bool isPlainBuild() const;
 
     // program states
     int checkArgs();
     int lookForMeiqueCache();
     int showVersion();
+    int showCacheStats();
     int showHelp();
     int dumpProject();
     int lookForMeiqueLua();
@@ -50,6 +56,10 @@ private:
     int uninstallTargets();
     int buildTargets();
     int cleanTargets();
+    int suggestPrecompiledHeaders();
+    int restart();
+    int requestBuild();
+    int runBuildServer();
 
     Meique(const Meique&) = delete;
 };
@@ -25,6 +25,15 @@ jobmanager.cpp
 oscommandjob.cpp
 luajob.cpp
 luacpputil.cpp
+tracer.cpp
+depslog.cpp
+filehash.cpp
+elfinterface.cpp
+objectcache.cpp
+remotecache.cpp
+filewatcher.cpp
+buildserver.cpp
+graphcache.cpp
 ]])
 
 meiqueLib:addFiles(meiqueLib:buildDir().."meiqueapi.cpp")
@@ -45,3 +54,4 @@ meique = Executable:new("meique")
 meique:addFile("main.cpp")
 meique:use(meiqueLib)
 UNIX:meique:install("bin")
+addSubdirectory("cacheserver")
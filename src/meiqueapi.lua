@@ -153,6 +153,7 @@ function Target:new(name)
         o._preTargetCompileHooks = {}
         o._installFiles = {}
         o._excludeFromAll = false
+        o._priority = 0
         abortIf(_meiqueAllTargets[tostring(name)], "You already have a target named "..name)
         _meiqueAllTargets[tostring(name)] = o
     end
@@ -181,6 +182,11 @@ function Target:excludeFromAll()
     self._excludeFromAll = true
 end
 
+-- Targets with higher priority, and their dependencies, are built first when possible.
+function Target:setPriority(priority)
+    self._priority = priority
+end
+
 function Target:addFile(file)
     table.insert(self._files, file)
 end
@@ -229,6 +235,11 @@ function CustomTarget:addOutputs(...)
     end
 end
 
+-- Only build the targets depending on this one if the contents of its outputs changed when it ran.
+function CustomTarget:setRestat(enabled)
+    self._restat = enabled ~= false
+end
+
 -- Compilable target
 CompilableTarget = Target:new(Target)
 
@@ -291,6 +302,16 @@ function addCustomFlags(self, flags)
 end
 CompilableTarget.addCustomFlags = addCustomFlags
 
+-- Precompile a header included by all C++ files of the target, or use the one of another target, on which it will depend.
+function CompilableTarget:setPrecompiledHeader(header)
+    if instanceOf(header, CompilableTarget) then
+        self._pchTarget = header._name
+        self:addDependency(header)
+    else
+        self._pch = header
+    end
+end
+
 function CompilableTarget:use(object)
     if instanceOf(object, Library) then
         table.insert(self._targets, object._name)
@@ -55,6 +55,7 @@ MeiqueCache::MeiqueCache()
 
     m_compiler = 0;
     m_autoSave = true;
+    m_relocatable = false;
 }
 
 MeiqueCache::~MeiqueCache()
@@ -79,7 +80,9 @@ void MeiqueCache::loadCache()
     lua_register(L, "Config", &readMeiqueConfig);
     lua_register(L, "Package", &readPackage);
     lua_register(L, "Scopes", &readScopes);
-    lua_register(L, "TargetHash", &readTargetHash);
+    lua_register(L, "NodeStats", &readNodeStats);
+    // Target hashes were written by older versions, command signatures are now in the dependency log.
+    lua_register(L, "TargetHash", [](lua_State*) { return 0; });
     // put a pointer to this instance of Config in lua registry, the key is the L address.
     lua_pushlightuserdata(L, (void *)L);
     lua_pushlightuserdata(L, (void *)this);
@@ -123,6 +126,8 @@ void MeiqueCache::saveCache()
     file << "    sourceDir = \"" << m_sourceDir << "\",\n";
     if (!m_installPrefix.empty())
         file << "    installPrefix = \"" << m_installPrefix << "\",\n";
+    if (m_relocatable)
+        file << "    relocatable = \"yes\",\n";
     file << "}\n\n";
 
     file << "Scopes {\n";
@@ -140,11 +145,24 @@ void MeiqueCache::saveCache()
         file << "}\n\n";
     }
 
-    // target hashes
-    for (auto& pair : m_targetHashes) {
-        file << "TargetHash {\n"
-                "    target = \"" << escape(pair.first) << "\",\n";
-        file << "    hash = \"" << escape(pair.second) << "\"\n";
+    // resources spent building each node
+    for (auto& pair : m_nodeStats) {
+        file << "NodeStats {\n"
+                "    target = \"" << escape(pair.first) << "\",\n"
+                "    nodes = {\n";
+        for (auto& p : pair.second) {
+            const NodeStats& stats = p.second;
+            file << "        [\"" << escape(p.first) << "\"] = { "
+                 << "duration = " << stats.duration << ", "
+                 << "userTime = " << stats.usage.userTime << ", "
+                 << "systemTime = " << stats.usage.systemTime << ", "
+                 << "peakMemory = " << stats.usage.peakMemory << ", "
+                 << "blockInputs = " << stats.usage.blockInputs << ", "
+                 << "blockOutputs = " << stats.usage.blockOutputs << ", "
+                 << "voluntaryContextSwitches = " << stats.usage.voluntaryContextSwitches << ", "
+                 << "involuntaryContextSwitches = " << stats.usage.involuntaryContextSwitches << " },\n";
+        }
+        file << "    }\n";
         file << "}\n\n";
     }
 }
@@ -169,19 +187,38 @@ int MeiqueCache::readMeiqueConfig(lua_State* L)
         self->m_buildType = opts.at("buildType") == "debug" ? Debug : Release;
         self->m_compilerId = opts.at("compiler");
         self->m_installPrefix = opts["installPrefix"];
+        self->m_relocatable = opts["relocatable"] == "yes";
     } catch (std::out_of_range&) {
         luaError(L, MEIQUECACHE " file corrupted or created by a old version of meique.");
     }
     return 0;
 }
 
-int MeiqueCache::readTargetHash(lua_State* L)
+int MeiqueCache::readNodeStats(lua_State* L)
 {
     LuaLeakCheck(L);
     MeiqueCache* self = getSelf(L);
     std::string target = luaGetField<std::string>(L, "target");
-    std::string hash = luaGetField<std::string>(L, "hash");
-    self->m_targetHashes[target] = hash;
+    lua_getfield(L, -1, "nodes");
+    LuaAutoPop autoPop(L);
+    if (!lua_istable(L, -1))
+        return 0;
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        if (lua_istable(L, -1)) {
+            NodeStats& stats = self->m_nodeStats[target][lua_tocpp<std::string>(L, -2)];
+            stats.duration = luaGetField<unsigned long>(L, "duration");
+            stats.usage.userTime = luaGetField<unsigned long>(L, "userTime");
+            stats.usage.systemTime = luaGetField<unsigned long>(L, "systemTime");
+            stats.usage.peakMemory = luaGetField<unsigned long>(L, "peakMemory");
+            stats.usage.blockInputs = luaGetField<unsigned long>(L, "blockInputs");
+            stats.usage.blockOutputs = luaGetField<unsigned long>(L, "blockOutputs");
+            stats.usage.voluntaryContextSwitches = luaGetField<unsigned long>(L, "voluntaryContextSwitches");
+            stats.usage.involuntaryContextSwitches = luaGetField<unsigned long>(L, "involuntaryContextSwitches");
+        }
+        lua_pop(L, 1);
+    }
     return 0;
 }
 
@@ -252,8 +289,39 @@ std::string MeiqueCache::installPrefix()
     return m_installPrefix;
 }
 
-std::string MeiqueCache::targetHash(const std::string& target) const
+NodeStats MeiqueCache::nodeStats(const std::string& target, const std::string& node) const
 {
-    auto it = m_targetHashes.find(target);
-    return it != m_targetHashes.end() ? it->second : std::string();
+    auto it = m_nodeStats.find(target);
+    if (it == m_nodeStats.end())
+        return NodeStats();
+    auto it2 = it->second.find(node);
+    return it2 != it->second.end() ? it2->second : NodeStats();
+}
+
+unsigned long MeiqueCache::averageNodeDuration() const
+{
+    unsigned long total = 0;
+    unsigned long count = 0;
+    for (auto& pair : m_nodeStats) {
+        for (auto& p : pair.second) {
+            total += p.second.duration;
+            count++;
+        }
+    }
+    return count ? total / count : 0;
+}
+
+unsigned long MeiqueCache::averageNodePeakMemory() const
+{
+    unsigned long total = 0;
+    unsigned long count = 0;
+    for (auto& pair : m_nodeStats) {
+        for (auto& p : pair.second) {
+            if (!p.second.usage.peakMemory)
+                continue;
+            total += p.second.usage.peakMemory;
+            count++;
+        }
+    }
+    return count ? total / count : 0;
 }
@@ -20,11 +20,22 @@
 #define MEIQUECACHE_H
 
 #include "basictypes.h"
+#include "os.h"
 
 class CmdLine;
 struct lua_State;
 class Compiler;
 
+/// Resources spent the last time a node was built.
+struct NodeStats
+{
+    NodeStats() : duration(0) {}
+    /// Wall time in milliseconds.
+    unsigned long duration;
+    /// Resources used by the external process that built the node, all zero for Lua jobs.
+    OS::ResourceUsage usage;
+};
+
 class MeiqueCache
 {
 public:
@@ -44,14 +55,22 @@ public:
     void setUserOptionsValues(const StringMap& options) { m_userOptions = options; }
     const StringMap& userOptionsValues() const { return m_userOptions; }
 
-    void setTargetHash(const std::string& target, const std::string& hash) { m_targetHashes[target] = hash; }
-    std::string targetHash(const std::string& target) const;
+    /// Stats of the last time \p node of \p target was built, an empty node means the target itself.
+    void setNodeStats(const std::string& target, const std::string& node, const NodeStats& stats) { m_nodeStats[target][node] = stats; }
+    NodeStats nodeStats(const std::string& target, const std::string& node = std::string()) const;
+    /// Average of all known node durations, 0 if there's none.
+    unsigned long averageNodeDuration() const;
+    /// Average of all known node peak memory usages, 0 if there's none.
+    unsigned long averageNodePeakMemory() const;
 
     void saveCache();
     void loadCache();
 
     void setBuildType(BuildType value) { m_buildType = value; }
     BuildType buildType() const { return m_buildType; }
+    /// Relocatable builds don't write the source and build directories into the objects.
+    void setRelocatable(bool value) { m_relocatable = value; }
+    bool isRelocatable() const { return m_relocatable; }
 
     StringMap package(const std::string& pkgName) const;
     bool hasPackage(const std::string& pkgName) const;
@@ -70,6 +89,7 @@ public:
 private:
     // Arguments
     BuildType m_buildType;
+    bool m_relocatable;
 
     // Env. stuff
     std::string m_compilerId;
@@ -84,7 +104,7 @@ private:
     StringMap m_userOptions;
     std::string m_installPrefix;
 
-    StringMap m_targetHashes;
+    std::map<std::string, std::map<std::string, NodeStats> > m_nodeStats;
 
     // helper variables
     bool m_autoSave;
@@ -93,7 +113,7 @@ private:
     static int readMeiqueConfig(lua_State* L);
     static int readPackage(lua_State* L);
     static int readScopes(lua_State* L);
-    static int readTargetHash(lua_State* L);
+    static int readNodeStats(lua_State* L);
 
     MeiqueCache(const MeiqueCache&) = delete;
 };
@@ -39,6 +39,7 @@
 #include "stdstringsux.h"
 #include "meiqueregex.h"
 #include "meiqueversion.h"
+#include "tracer.h"
 
 enum TargetTypes {
     EXECUTABLE_TARGET = 1,
@@ -79,6 +80,7 @@ MeiqueScript::MeiqueScript(const std::string scriptName, const CmdLine* cmdLine)
 {
     m_cache.setBuildType(cmdLine->boolArg("debug") ? MeiqueCache::Debug : MeiqueCache::Release);
     m_cache.setInstallPrefix(cmdLine->arg("install-prefix"));
+    m_cache.setRelocatable(cmdLine->boolArg("relocatable"));
     m_cache.setSourceDir(OS::dirName(scriptName));
     m_cache.setCompilerId(findCompilerId());
 
@@ -101,6 +103,7 @@ void MeiqueScript::populateOptionsValues()
             static const char* options[] = {
                 "debug",
                 "install-prefix",
+                "relocatable",
                 "release"
             };
             static auto end = options + sizeof(options)/sizeof(char*);
@@ -123,6 +126,7 @@ std::string MeiqueScript::sourceDir() const
 
 void MeiqueScript::exec()
 {
+    TraceScope trace("Script execution", m_scriptName);
     OS::ChangeWorkingDirectory dirChanger(sourceDir());
 
     exportApi();
@@ -698,6 +702,14 @@ void MeiqueScript::cleanTargets(const StringList& targets)
                 objFile.insert(0, m_buildDir + directory);
             OS::rm(objFile);
         }
+
+        std::string pch = luaGetField<std::string>(m_L, "_pch");
+        if (!pch.empty()) {
+            pch = compiler->nameForPrecompiledHeader(pch, target);
+            if (pch[0] != '/')
+                pch.insert(0, m_buildDir + directory);
+            OS::rm(pch);
+        }
     }
 }
 
@@ -25,15 +25,20 @@
 #include <fstream>
 #include <memory>
 #include <list>
+#include <unordered_set>
 
 #include "meiquescript.h"
 #include "nodevisitor.h"
 #include "luacpputil.h"
 #include "logger.h"
 #include "stdstringsux.h"
+#include "tracer.h"
 
 Node::Node(const std::string& name)
     : name(name)
+    , pendingChildren(0)
+    , priority(0)
+    , criticalPath(0)
     , status(Pristine)
     , targetType(0)
     , isTarget(false)
@@ -41,6 +46,10 @@ Node::Node(const std::string& name)
     , shouldBuild(false)
     , isFake(false)
     , isHook(false)
+    , hasFailed(false)
+    , restat(false)
+    , cacheMiss(false)
+    , isPrecompiledHeader(false)
 {
 }
 
@@ -48,8 +57,12 @@ NodeTree::NodeTree(MeiqueScript& script, const StringList& targets)
     : m_script(script)
     , m_L(script.luaState())
     , m_root(nullptr)
-    , m_hasFail(false)
+    , m_failureCount(0)
+    , m_nodesToBuild(0)
+    , m_averageDuration(0)
+    , m_averagePeakMemory(0)
 {
+    TraceScope trace("NodeTree construction");
     buildNotExpandedTree();
     if (!targets.empty())
         removeUnusedTargets(targets);
@@ -57,6 +70,7 @@ NodeTree::NodeTree(MeiqueScript& script, const StringList& targets)
     NodeVisitor<>(*this, [](Node* n) {});
     connectForest(targets);
     addTargetHookNodes();
+    initReadyNodes();
     m_size = m_targetNodes.size();
 }
 
@@ -117,16 +131,63 @@ void NodeTree::expandTargetNode(Node* target)
     if (target->isCustomTarget())
         return;
 
+    Node* pchNode = addPrecompiledHeaderNode(target);
+
     // populate the node
     for (std::string& file : luaGetField<StringList>(m_L, "_files")) {
         Node* fileNode = new Node(file);
         fileNode->shouldBuild = target->shouldBuild;
         fileNode->parents.push_back(target);
         target->children.push_back(fileNode);
+        fileNode->priority = target->priority;
+        fileNode->criticalPath = target->criticalPath + expectedDuration(target, fileNode);
+        target->pendingChildren++;
+        if (pchNode) {
+            fileNode->children.push_back(pchNode);
+            pchNode->parents.push_back(fileNode);
+        }
+        // The precompiled header of another target may be built already.
+        if (pchNode && pchNode->status != Node::Built)
+            fileNode->pendingChildren++;
+        else
+            m_readyNodes.push(fileNode);
         m_size++;
+        m_nodesToBuild++;
+    }
+
+    // Only ready now, as it's in the critical path of all files using it.
+    if (pchNode && pchNode->parents.front() == target) {
+        for (Node* parent : pchNode->parents)
+            pchNode->criticalPath = std::max(pchNode->criticalPath, parent->criticalPath);
+        pchNode->criticalPath += expectedDuration(target, pchNode);
+        m_readyNodes.push(pchNode);
     }
 }
 
+Node* NodeTree::addPrecompiledHeaderNode(Node* target)
+{
+    // The other target is a dependency, so it was expanded already.
+    const std::string pchTarget = luaGetField<std::string>(m_L, "_pchTarget");
+    if (!pchTarget.empty())
+        return m_precompiledHeaders[target] = m_precompiledHeaders[m_targetNodes.at(pchTarget)];
+
+    const std::string header = luaGetField<std::string>(m_L, "_pch");
+    if (header.empty())
+        return nullptr;
+
+    Node* pchNode = new Node(header);
+    pchNode->isPrecompiledHeader = true;
+    pchNode->shouldBuild = target->shouldBuild;
+    pchNode->parents.push_back(target);
+    target->children.push_back(pchNode);
+    pchNode->priority = target->priority;
+    target->pendingChildren++;
+    m_size++;
+    m_nodesToBuild++;
+    m_precompiledHeaders[target] = pchNode;
+    return pchNode;
+}
+
 void NodeTree::expandTargetNode(const std::string& target)
 {
     Node* targetNode = m_targetNodes[target];
@@ -187,6 +248,8 @@ void NodeTree::buildNotExpandedTree()
         Node* node = new Node(targetName);
         node->isTarget = true;
         node->targetType = luaGetField<int>(m_L, "_type");
+        node->priority = luaGetField<int>(m_L, "_priority");
+        node->restat = node->isCustomTarget() && luaGetField<bool>(m_L, "_restat");
 
         m_targetNodes[targetName] = node;
         lua_pop(m_L, 1);
@@ -255,6 +318,122 @@ void NodeTree::addTargetHookNodes()
     }
 }
 
+void NodeTree::initReadyNodes()
+{
+    if (!m_root)
+        return;
+
+    m_averageDuration = std::max(1ul, m_script.cache().averageNodeDuration());
+    m_averagePeakMemory = m_script.cache().averageNodePeakMemory();
+
+    // Only nodes reachable from the root are counted, so targets excluded from the build never become ready.
+    std::vector<Node*> nodes;
+    NodeVisitor<>(m_root, [&](Node* node) {
+        node->pendingChildren = node->children.size();
+        nodes.push_back(node);
+    });
+    m_nodesToBuild = nodes.size();
+
+    // Children are visited before their parents, so walk backwards to have the parents critical path already calculated.
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        Node* node = *it;
+        unsigned long parentsCriticalPath = 0;
+        for (Node* parent : node->parents) {
+            parentsCriticalPath = std::max(parentsCriticalPath, parent->criticalPath);
+            node->priority = std::max(node->priority, parent->priority);
+        }
+        Node* target = node->isHook ? node->parents.front() : node;
+        node->criticalPath = parentsCriticalPath + expectedDuration(target, node);
+    }
+
+    for (Node* node : nodes) {
+        if (node->children.empty())
+            m_readyNodes.push(node);
+    }
+}
+
+unsigned long NodeTree::expectedDuration(Node* target, Node* node) const
+{
+    if (node->isFake && !node->isHook)
+        return 0;
+
+    unsigned long duration = m_script.cache().nodeStats(target->name, node == target ? std::string() : node->name).duration;
+    return duration ? duration : m_averageDuration;
+}
+
+unsigned long NodeTree::expectedPeakMemory(Node* target, Node* node) const
+{
+    unsigned long peakMemory = m_script.cache().nodeStats(target->name, node == target ? std::string() : node->name).usage.peakMemory;
+    return peakMemory ? peakMemory : m_averagePeakMemory;
+}
+
+Node* NodeTree::takeReadyNode()
+{
+    if (m_readyNodes.empty())
+        return nullptr;
+    Node* node = m_readyNodes.top();
+    m_readyNodes.pop();
+    return node;
+}
+
+void NodeTree::setNodeBuilt(Node* node)
+{
+    node->status = Node::Built;
+    m_nodesToBuild--;
+    for (Node* parent : node->parents) {
+        if (parent->pendingChildren && !--parent->pendingChildren)
+            m_readyNodes.push(parent);
+    }
+}
+
+unsigned NodeTree::rescheduleNodes(const std::vector<Node*>& nodes)
+{
+    if (!m_root)
+        return 0;
+
+    std::unordered_set<Node*> nodesToBuild;
+    auto addWithAncestors = [&](Node* node) {
+        NodeVisitor<NodeGetParent>(node, [&](Node* ancestor) {
+            nodesToBuild.insert(ancestor);
+        });
+    };
+    for (Node* node : nodes)
+        addWithAncestors(node);
+    NodeVisitor<>(m_root, [&](Node* node) {
+        if (node->status != Node::Built)
+            addWithAncestors(node);
+    });
+
+    m_readyNodes = decltype(m_readyNodes)();
+    m_failureCount = 0;
+    m_nodesToBuild = nodesToBuild.size();
+    for (Node* node : nodesToBuild) {
+        node->hasFailed = false;
+        node->shouldBuild = false;
+        node->cacheMiss = false;
+        // Targets keep the files they were expanded to, hooks aren't run again for them.
+        if (node->status != Node::Pristine)
+            node->status = node->isTarget ? Node::Expanded : Node::Pristine;
+        node->pendingChildren = std::count_if(node->children.begin(), node->children.end(), [&](Node* child) {
+            return nodesToBuild.count(child) > 0;
+        });
+        if (!node->pendingChildren)
+            m_readyNodes.push(node);
+    }
+    return nodesToBuild.size();
+}
+
+void NodeTree::setNodeFailed(Node* node)
+{
+    m_failureCount++;
+    NodeVisitor<NodeGetParent>(node, [&](Node* ancestor) {
+        if (!ancestor->hasFailed) {
+            ancestor->hasFailed = true;
+            m_nodesToBuild--;
+        }
+    });
+}
+
 NodeGuard::NodeGuard(NodeTree& tree, Node* node)
     : m_tree(tree)
     , m_node(node)
@@ -266,10 +445,11 @@ NodeGuard::~NodeGuard()
 {
     {
         std::lock_guard<NodeTree> lock(m_tree);
+        m_node->stats = m_stats;
         if (m_failed)
-            m_tree.failed();
+            m_tree.setNodeFailed(m_node);
         else
-            m_node->status = Node::Built;
+            m_tree.setNodeBuilt(m_node);
     }
-    m_tree.onTreeChange();
+    m_tree.m_treeChanged.notify_all();
 }
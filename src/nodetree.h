@@ -19,11 +19,15 @@
 #ifndef NODETREE_H
 #define NODETREE_H
 
+#include <condition_variable>
 #include <list>
+#include <queue>
 #include <unordered_map>
+#include <vector>
 #include <lua.h>
 #include <mutex>
 #include "basictypes.h"
+#include "meiquecache.h"
 
 class MeiqueScript;
 class Node;
@@ -56,6 +60,14 @@ public:
     std::string name;
     NodeList parents;
     NodeList children;
+    /// Number of children not built yet, the node is ready to be processed when it reaches zero.
+    unsigned pendingChildren;
+    /// Priority hint set by the user with Target:setPriority(), inherited from parents.
+    int priority;
+    /// Estimated time in milliseconds to build this node and all its parents up to the root.
+    unsigned long criticalPath;
+    /// Resources spent building this node, all zero if it wasn't built in this run.
+    NodeStats stats;
     unsigned status:2;
     unsigned targetType:2;
     unsigned isTarget:1;
@@ -63,6 +75,14 @@ public:
     unsigned shouldBuild:1;
     unsigned isFake:1;
     unsigned isHook:1;
+    /// The node or one of its children failed to build, so it will never be built.
+    unsigned hasFailed:1;
+    /// Custom target whose parents are only built if its outputs change, see CustomTarget:setRestat().
+    unsigned restat:1;
+    /// Object already looked up in the object cache without success.
+    unsigned cacheMiss:1;
+    /// Precompiled header, its first parent is its target and the others the files using it.
+    unsigned isPrecompiledHeader:1;
 
 private:
     Node(const Node&) = delete;
@@ -74,6 +94,8 @@ public:
     ~NodeGuard();
 
     void failed() { m_failed = true; }
+    NodeStats& stats() { return m_stats; }
+    const Node* node() const { return m_node; }
 
     NodeGuard(const NodeGuard&) = delete;
     NodeGuard& operator=(const NodeGuard&) = delete;
@@ -81,6 +103,7 @@ private:
     NodeTree& m_tree;
     Node* m_node;
     bool m_failed;
+    NodeStats m_stats;
 };
 
 class NodeTree
@@ -115,10 +138,29 @@ public:
     void dump(const char* fileName = 0) const;
     Node* root() const { return m_root; }
 
-    std::function<void ()> onTreeChange;
-
-    void failed() { m_hasFail = true; }
-    bool hasFail() const { return m_hasFail; }
+    /// Peak memory in KiB used the last time \p node was built, or an average if unknown.
+    unsigned long expectedPeakMemory(Node* target, Node* node) const;
+
+    // The methods below must be called with the tree locked.
+
+    /// Returns the node with all children built and the highest priority/longest critical path, or nullptr if there's none.
+    Node* takeReadyNode();
+    /// Mark \p node as built, parents with no more pending children become ready.
+    void setNodeBuilt(Node* node);
+    /// Wait for some node to be built or fail.
+    void waitForChanges(std::unique_lock<NodeTree>& lock) { m_treeChanged.wait(lock); }
+
+    /// Mark \p node and all its ancestors as failed, the other nodes can still be built.
+    void setNodeFailed(Node* node);
+    /// Number of nodes that failed to build.
+    unsigned failureCount() const { return m_failureCount; }
+    /// True when there's nothing more that can be built, i.e. all nodes were built or have failed.
+    bool isFinished() const { return !m_nodesToBuild; }
+    /**
+     * After a build finishes, schedule \p nodes and their ancestors to be processed again, like
+     * the nodes that failed or weren't built. Returns the number of nodes scheduled.
+     */
+    unsigned rescheduleNodes(const std::vector<Node*>& nodes);
 
     void lock() { m_mutex.lock(); }
     void unlock() { m_mutex.unlock(); }
@@ -127,16 +169,36 @@ private:
     void removeUnusedTargets(const StringList& targets);
     void connectForest(const StringList& selectedTargets);
     void addTargetHookNodes();
+    Node* addPrecompiledHeaderNode(Node* target);
+    void initReadyNodes();
+    unsigned long expectedDuration(Node* target, Node* node) const;
 
     MeiqueScript& m_script;
     lua_State* m_L;
     TargetNodeMap m_targetNodes;
+    /// Precompiled header used by each expanded target, maybe of another target.
+    std::unordered_map<Node*, Node*> m_precompiledHeaders;
     Node* m_root;
-    bool m_hasFail;
+    unsigned m_failureCount;
+    /// Nodes reachable from the root not built yet and not failed.
+    unsigned m_nodesToBuild;
 
     unsigned m_size;
 
+    struct ReadyNodeCompare {
+        bool operator()(const Node* a, const Node* b) const
+        {
+            return a->priority < b->priority || (a->priority == b->priority && a->criticalPath < b->criticalPath);
+        }
+    };
+    std::priority_queue<Node*, std::vector<Node*>, ReadyNodeCompare> m_readyNodes;
+    unsigned long m_averageDuration;
+    unsigned long m_averagePeakMemory;
+
     std::mutex m_mutex;
+    std::condition_variable_any m_treeChanged;
+
+    friend class NodeGuard;
 
     NodeTree(const NodeTree&) = delete;
 };
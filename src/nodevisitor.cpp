@@ -52,7 +52,7 @@ void NodeVisitor<NextNodeGetter>::visitNode(Node* node)
         case Visiting:
             throw Error("Cyclic dependence found on your targets.");
         case Visited:
-            return;
+            break;
         }
     }
     m_visitor(node);
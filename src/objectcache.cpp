@@ -0,0 +1,423 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "objectcache.h"
+#include "depslog.h"
+#include "filehash.h"
+#include "logger.h"
+#include "os.h"
+#include "stdstringsux.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+}
+
+// Manifests bigger than this are started again, there are too many outdated entries on them.
+static const long long MaxManifestSize = 64 * 1024;
+
+// Roots replaced by placeholders in relocatable builds, the longest one first.
+static std::vector<std::pair<std::string, std::string> > relocationRoots;
+
+// Roots are only replaced when they are the whole directory name, so /a/src doesn't match /a/src2.
+static std::string relocate(std::string text)
+{
+    for (const auto& root : relocationRoots) {
+        size_t pos = text.find(root.first);
+        while (pos != std::string::npos) {
+            const size_t end = pos + root.first.size();
+            if (end == text.size() || text[end] == '/') {
+                text.replace(pos, root.first.size(), root.second);
+                pos += root.second.size();
+            } else {
+                pos++;
+            }
+            pos = text.find(root.first, pos);
+        }
+    }
+    return text;
+}
+
+// Flags like -DDIR=/a/src or -ffile-prefix-map=/a/src=.. have paths ending at a '='.
+static std::string relocateArgument(const std::string& arg)
+{
+    std::string result;
+    size_t start = 0;
+    for (size_t pos = arg.find('='); pos != std::string::npos; start = pos + 1, pos = arg.find('=', start))
+        result += relocate(arg.substr(start, pos - start)) + '=';
+    return result + relocate(arg.substr(start));
+}
+
+static std::string resolve(const std::string& path)
+{
+    for (const auto& root : relocationRoots) {
+        if (path.compare(0, root.second.size(), root.second) == 0)
+            return root.first + path.substr(root.second.size());
+    }
+    return path;
+}
+
+ObjectCache::ObjectCache(const std::string& directory, unsigned long long maxSize)
+    : m_directory(directory)
+    , m_maxSize(maxSize)
+{
+}
+
+ObjectCache::~ObjectCache()
+{
+    saveStats();
+}
+
+std::string ObjectCache::defaultDirectory()
+{
+    std::string directory = OS::getEnv("MEIQUE_CACHE_DIR");
+    if (directory.empty())
+        directory = OS::getEnv("HOME") + "/.cache/meique";
+    return OS::normalizeDirPath(directory);
+}
+
+unsigned long long ObjectCache::defaultMaxSize()
+{
+    unsigned long long maxSize = std::strtoull(OS::getEnv("MEIQUE_CACHE_SIZE").c_str(), 0, 10);
+    return (maxSize ? maxSize : 5 * 1024) * 1024 * 1024;
+}
+
+void ObjectCache::setRelocationRoots(const std::string& sourceDir, const std::string& buildDir)
+{
+    // Without the trailing slash, to also match the directories themselves.
+    relocationRoots.clear();
+    relocationRoots.push_back(std::make_pair(sourceDir.substr(0, sourceDir.size() - 1), std::string("<source>")));
+    relocationRoots.push_back(std::make_pair(buildDir.substr(0, buildDir.size() - 1), std::string("<build>")));
+    if (relocationRoots[0].first.size() < relocationRoots[1].first.size())
+        std::swap(relocationRoots[0], relocationRoots[1]);
+}
+
+std::string ObjectCache::path(uint64_t hash, const char* suffix) const
+{
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return m_directory + std::string(name, 2) + '/' + (name + 2) + suffix;
+}
+
+uint64_t ObjectCache::compilerIdentity(const std::string& program)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, uint64_t> identities;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = identities.find(program);
+    if (it != identities.end())
+        return it->second;
+
+    // Like ccache, the compiler is identified by its path, size and modification time.
+    std::string path = program;
+    if (program.find('/') == std::string::npos) {
+        for (const std::string& dir : split(OS::getEnv("PATH"), ':')) {
+            if (OS::fileExists(dir + '/' + program)) {
+                path = dir + '/' + program;
+                break;
+            }
+        }
+    }
+    const long long info[] = { OS::fileSize(path), OS::modificationTime(path) };
+    const uint64_t identity = hashData(info, sizeof(info), hashString(path));
+    identities[program] = identity;
+    return identity;
+}
+
+uint64_t ObjectCache::key(const StringList& command, const std::string& workingDirectory, const std::string& output, uint64_t sourceHash)
+{
+    uint64_t hash = compilerIdentity(command.front());
+    // Debug information has the working directory.
+    hash = hashString(relocate(workingDirectory), hash);
+    const std::string depFile = output + ".d";
+    for (const std::string& arg : command) {
+        if (arg == output)
+            hash = hashString("<output>", hash);
+        else if (arg == depFile)
+            hash = hashString("<output>.d", hash);
+        else
+            hash = hashString(relocateArgument(arg), hash);
+    }
+    return hashData(&sourceHash, sizeof(sourceHash), hash);
+}
+
+ObjectCache::Manifest ObjectCache::parseManifest(std::istream& in)
+{
+    // Each entry is a line with the object hash and the number of dependencies, then a line per dependency.
+    Manifest manifest;
+    ManifestEntry entry;
+    size_t count;
+    while (in >> std::hex >> entry.object >> std::dec >> count) {
+        entry.deps.resize(count);
+        for (Dependency& dep : entry.deps) {
+            in >> std::hex >> dep.hash;
+            in.get();
+            std::getline(in, dep.path);
+        }
+        if (!in)
+            break;
+        manifest.push_back(entry);
+    }
+    return manifest;
+}
+
+std::string ObjectCache::serializeEntry(const ManifestEntry& entry)
+{
+    std::ostringstream data;
+    data << std::hex << entry.object << ' ' << std::dec << entry.deps.size() << '\n';
+    for (const Dependency& dep : entry.deps)
+        data << std::hex << dep.hash << ' ' << dep.path << '\n';
+    return data.str();
+}
+
+bool ObjectCache::createEntry(uint64_t key, const std::string& output, DepsLog& depsLog, ManifestEntry& entry)
+{
+    std::vector<const std::string*> deps;
+    if (!depsLog.dependencies(output, OS::modificationTime(output), deps))
+        return false;
+
+    // The object is identified by the key and the contents of all dependencies.
+    entry.object = key;
+    entry.deps.clear();
+    for (const std::string* dep : deps) {
+        Dependency dependency = { relocate(*dep), depsLog.fileHash(*dep) };
+        if (!dependency.hash)
+            return false;
+        entry.object = hashString(dependency.path, entry.object);
+        entry.object = hashData(&dependency.hash, sizeof(dependency.hash), entry.object);
+        entry.deps.push_back(dependency);
+    }
+    return true;
+}
+
+const ObjectCache::ManifestEntry* ObjectCache::findEntry(const Manifest& manifest, DepsLog& depsLog)
+{
+    // Newer entries are more likely to match.
+    for (auto it = manifest.rbegin(); it != manifest.rend(); ++it) {
+        bool match = true;
+        for (const Dependency& dep : it->deps) {
+            if (depsLog.fileHash(resolve(dep.path)) != dep.hash) {
+                match = false;
+                break;
+            }
+        }
+        if (match)
+            return &*it;
+    }
+    return nullptr;
+}
+
+void ObjectCache::writeDepFile(const std::string& output, const ManifestEntry& entry)
+{
+    std::ofstream depFile((output + ".d").c_str(), std::ios::out | std::ios::trunc);
+    depFile << output << ':';
+    for (const Dependency& dep : entry.deps) {
+        std::string escaped;
+        for (char c : resolve(dep.path))
+            escaped += c == ' ' ? "\\ " : std::string(1, c);
+        depFile << ' ' << escaped;
+    }
+    depFile << '\n';
+    OS::invalidateFileInfo(output + ".d");
+}
+
+ObjectCache::Manifest ObjectCache::readManifest(uint64_t key) const
+{
+    std::ifstream file(path(key, ".manifest").c_str());
+    return parseManifest(file);
+}
+
+bool ObjectCache::fetch(uint64_t key, const std::string& output, DepsLog& depsLog)
+{
+    const Manifest manifest = readManifest(key);
+    const ManifestEntry* entry = findEntry(manifest, depsLog);
+    const std::string object = entry ? path(entry->object, ".o") : std::string();
+    if (!entry || !OS::copyFile(object, output)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.misses++;
+        return false;
+    }
+
+    // Used now, so it's the last to be evicted.
+    OS::setModificationTime(object, OS::modificationTime(output));
+    writeDepFile(output, *entry);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.hits++;
+    return true;
+}
+
+void ObjectCache::store(uint64_t key, const std::string& output, DepsLog& depsLog)
+{
+    ManifestEntry entry;
+    if (!createEntry(key, output, depsLog, entry))
+        return;
+    for (const ManifestEntry& stored : readManifest(key)) {
+        if (stored.object == entry.object)
+            return;
+    }
+
+    // Copied through a temporary file, so nobody sees incomplete objects.
+    const std::string object = path(entry.object, ".o");
+    OS::mkdir(OS::dirName(object));
+    if (!OS::copyFile(output, object)) {
+        Debug() << "Unable to store " << output << " in the object cache.";
+        return;
+    }
+
+    // Appended in a single write, other processes may be appending to the same manifest.
+    const std::string manifest = path(key, ".manifest");
+    const long long oldManifestSize = OS::fileSize(manifest);
+    const bool restartManifest = oldManifestSize > MaxManifestSize;
+    OS::mkdir(OS::dirName(manifest));
+    const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (restartManifest ? O_TRUNC : O_APPEND);
+    OS::invalidateFileInfo(manifest);
+    int fd = ::open(manifest.c_str(), flags, 0644);
+    if (fd == -1)
+        return;
+    const std::string manifestData = serializeEntry(entry);
+    const bool written = ::write(fd, manifestData.data(), manifestData.size()) == static_cast<ssize_t>(manifestData.size());
+    ::close(fd);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.stores++;
+    m_stats.size += OS::fileSize(object) + (written ? static_cast<long long>(manifestData.size()) : 0) - (restartManifest ? oldManifestSize : 0);
+}
+
+ObjectCache::Stats ObjectCache::readStats(const std::string& data)
+{
+    Stats stats;
+    std::istringstream in(data);
+    std::string name;
+    long long value;
+    while (in >> name >> value) {
+        if (name == "hits")
+            stats.hits = value;
+        else if (name == "misses")
+            stats.misses = value;
+        else if (name == "stores")
+            stats.stores = value;
+        else if (name == "evictions")
+            stats.evictions = value;
+        else if (name == "size")
+            stats.size = value;
+    }
+    return stats;
+}
+
+void ObjectCache::saveStats()
+{
+    if (!m_stats.hits && !m_stats.misses && !m_stats.stores)
+        return;
+
+    OS::mkdir(m_directory);
+    int fd = ::open((m_directory + "stats").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        Warn() << "Unable to save the object cache statistics in " << m_directory << '.';
+        return;
+    }
+    // Other meique processes may be using the same cache.
+    ::flock(fd, LOCK_EX);
+
+    std::string data;
+    char buffer[1024];
+    ssize_t bytes;
+    while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, bytes);
+
+    Stats stats = readStats(data);
+    stats.hits += m_stats.hits;
+    stats.misses += m_stats.misses;
+    stats.stores += m_stats.stores;
+    stats.size = std::max(0ll, stats.size + m_stats.size);
+    if (static_cast<unsigned long long>(stats.size) > m_maxSize)
+        evict(stats);
+    m_stats = Stats();
+
+    std::ostringstream out;
+    out << "hits " << stats.hits << "\nmisses " << stats.misses << "\nstores " << stats.stores
+        << "\nevictions " << stats.evictions << "\nsize " << stats.size << '\n';
+    data = out.str();
+    if (::ftruncate(fd, 0) || ::pwrite(fd, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size()))
+        Warn() << "Unable to save the object cache statistics in " << m_directory << '.';
+    ::close(fd);
+}
+
+void ObjectCache::evict(Stats& stats)
+{
+    struct File {
+        long long time;
+        long long size;
+        std::string path;
+        bool operator<(const File& other) const { return time < other.time; }
+    };
+
+    // The size is computed again, the statistics may be wrong if a build was interrupted.
+    std::vector<File> files;
+    long long size = 0;
+    for (const std::string& subdir : OS::listDir(m_directory)) {
+        if (subdir.size() != 2)
+            continue;
+        const std::string dir = m_directory + subdir + '/';
+        for (const std::string& name : OS::listDir(dir)) {
+            File file = { OS::modificationTime(dir + name), OS::fileSize(dir + name), dir + name };
+            size += file.size;
+            files.push_back(file);
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    // Remove a bit more than needed, so it doesn't happen again on the next build.
+    const long long limit = m_maxSize / 10 * 9;
+    for (const File& file : files) {
+        if (size <= limit)
+            break;
+        if (OS::rm(file.path)) {
+            size -= file.size;
+            stats.evictions++;
+        }
+    }
+    Debug() << "Object cache cleaned up, " << size << " bytes used.";
+    stats.size = size;
+}
+
+void ObjectCache::printStats(std::ostream& out)
+{
+    std::ifstream file((m_directory + "stats").c_str());
+    std::ostringstream data;
+    data << file.rdbuf();
+    const Stats stats = readStats(data.str());
+
+    const unsigned long long lookups = stats.hits + stats.misses;
+    out << "Cache directory:    " << m_directory << '\n';
+    out << "Hits:               " << stats.hits << '\n';
+    out << "Misses:             " << stats.misses << '\n';
+    out << "Hit rate:           " << std::fixed << std::setprecision(1) << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "%\n";
+    out << "Stored objects:     " << stats.stores << '\n';
+    out << "Evicted files:      " << stats.evictions << '\n';
+    out << "Size:               " << stats.size / (1024.0 * 1024.0) << " MiB of " << m_maxSize / (1024 * 1024) << " MiB\n";
+}
@@ -0,0 +1,120 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OBJECTCACHE_H
+#define OBJECTCACHE_H
+
+#include "basictypes.h"
+#include <stdint.h>
+#include <mutex>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+class DepsLog;
+
+/**
+ * Content addressed cache of object files shared by all builds of the user, like ccache in direct mode.
+ *
+ * Compilations are identified by a key made of the compiler identity, the command line and the source
+ * contents. Each key has a manifest listing the dependencies, with their content hashes, found by the
+ * compiler each time an object was stored for it. When all dependencies of some manifest entry still
+ * have the same contents the object is copied from the cache instead of being compiled.
+ *
+ * Headers in system directories are tracked too, they are in the dependencies written by the compiler.
+ *
+ * For relocatable builds the source and build directories are replaced by placeholders in keys and
+ * manifests, so the objects are reused by other checkouts of the project.
+ *
+ * The statistics are saved when the cache is destroyed, the least recently used files are then removed
+ * if the cache is bigger than its maximum size. All methods are thread safe.
+ */
+class ObjectCache
+{
+public:
+    ObjectCache(const std::string& directory, unsigned long long maxSize);
+    ~ObjectCache();
+
+    /// $MEIQUE_CACHE_DIR or ~/.cache/meique/.
+    static std::string defaultDirectory();
+    /// $MEIQUE_CACHE_SIZE MiB, default to 5 GiB.
+    static unsigned long long defaultMaxSize();
+    /// Write the paths under \p sourceDir and \p buildDir relative to them in keys and manifests, must be called before any job starts.
+    static void setRelocationRoots(const std::string& sourceDir, const std::string& buildDir);
+
+    /**
+     * Key of the compilation of \p output using \p command, run from \p workingDirectory.
+     *
+     * \p sourceHash is the hash of the source contents. The output path isn't part of the key.
+     */
+    static uint64_t key(const StringList& command, const std::string& workingDirectory, const std::string& output, uint64_t sourceHash);
+    /// Copy the object compiled for \p key into \p output, with its dependency file, returns false on misses.
+    bool fetch(uint64_t key, const std::string& output, DepsLog& depsLog);
+    /// Store \p output, compiled for \p key, with the dependencies recorded in \p depsLog.
+    void store(uint64_t key, const std::string& output, DepsLog& depsLog);
+
+    /// Print the statistics saved in the cache.
+    void printStats(std::ostream& out);
+
+    struct Dependency {
+        std::string path;
+        uint64_t hash;
+    };
+    /// An object stored for some key and the dependencies it was compiled with.
+    struct ManifestEntry {
+        uint64_t object;
+        std::vector<Dependency> deps;
+    };
+    typedef std::vector<ManifestEntry> Manifest;
+
+    static Manifest parseManifest(std::istream& in);
+    static std::string serializeEntry(const ManifestEntry& entry);
+    /// Entry for \p output, compiled for \p key, with the dependencies recorded in \p depsLog, returns false if some can't be read.
+    static bool createEntry(uint64_t key, const std::string& output, DepsLog& depsLog, ManifestEntry& entry);
+    /// The newest entry of \p manifest whose dependencies didn't change, null if none.
+    static const ManifestEntry* findEntry(const Manifest& manifest, DepsLog& depsLog);
+    /// Write the dependency file of \p output, with the dependencies of \p entry.
+    static void writeDepFile(const std::string& output, const ManifestEntry& entry);
+
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+private:
+    struct Stats {
+        Stats() : hits(0), misses(0), stores(0), evictions(0), size(0) {}
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long stores;
+        unsigned long long evictions;
+        long long size;
+    };
+
+    std::string m_directory;
+    unsigned long long m_maxSize;
+    // Changes not saved yet.
+    Stats m_stats;
+    std::mutex m_mutex;
+
+    std::string path(uint64_t hash, const char* suffix) const;
+    static uint64_t compilerIdentity(const std::string& program);
+    Manifest readManifest(uint64_t key) const;
+    void saveStats();
+    void evict(Stats& stats);
+    static Stats readStats(const std::string& data);
+};
+
+#endif
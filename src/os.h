@@ -28,11 +28,59 @@ namespace OS
         MergeErr
     };
 
+    /// Resources used by a finished process.
+    struct ResourceUsage
+    {
+        ResourceUsage()
+            : userTime(0), systemTime(0), peakMemory(0), blockInputs(0), blockOutputs(0)
+            , voluntaryContextSwitches(0), involuntaryContextSwitches(0)
+        {
+        }
+        unsigned long cpuTime() const { return userTime + systemTime; }
+
+        /// CPU time in milliseconds.
+        unsigned long userTime;
+        unsigned long systemTime;
+        /// Maximum resident set size in KiB.
+        unsigned long peakMemory;
+        /// Number of file system reads and writes.
+        unsigned long blockInputs;
+        unsigned long blockOutputs;
+        unsigned long voluntaryContextSwitches;
+        unsigned long involuntaryContextSwitches;
+    };
+
     int exec(const char* cmd, std::string* output = 0, const char* workingDir = 0, ExecOptions options = None);
     inline int exec(const std::string& cmd, std::string* output = 0, const char* workingDir = 0, ExecOptions options = None)
     {
         return exec(cmd.c_str(), output, workingDir, options);
     }
+    /**
+     * Run the program \p args.front() passing the remaining items as arguments.
+     *
+     * The program is spawned directly, without a shell, unless some argument is shell text marked
+     * by shellText() with shell meta characters, e.g. quotes in user written compiler flags. The other
+     * arguments are then quoted, so the shell passes them untouched. If \p usage isn't null
+     * it's filled with the resources used by the process.
+     */
+    int exec(const StringList& args, std::string* output = 0, const char* workingDir = 0, ExecOptions options = None, ResourceUsage* usage = 0);
+    /// Mark \p text, an argument of exec() or spawn(), as shell text written by the user.
+    std::string shellText(const std::string& text);
+    /**
+     * Like exec, but doesn't wait the process to finish.
+     *
+     * The process standard output and error are redirected to \p outputFd and \p errorFd unless they are -1.
+     * Returns the process id or -1 on errors.
+     */
+    int spawn(const StringList& args, const char* workingDir = 0, int outputFd = -1, int errorFd = -1);
+    /// Returns a file descriptor that becomes readable when the process \p pid exits, -1 if not supported.
+    int processFd(int pid);
+    /**
+     * Like waitpid, but also collects the resources used by the process if \p usage isn't null.
+     *
+     * Returns the process id, 0 if \p block is false and the process is still running or -1 on errors.
+     */
+    int waitProcess(int pid, int* status, ResourceUsage* usage = 0, bool block = true);
 
     /// Like cd command.
     void cd(const char* dir);
@@ -41,11 +89,31 @@ namespace OS
     std::string pwd();
     /// Like mkdir -p.
     void mkdir(const std::string& dir);
+    /**
+     * Enable or disable the cache of file metadata used by fileExists(), dirExists(), modificationTime()
+     * and timestampCompare().
+     *
+     * When enabled each absolute path is stat'ed only once, so who writes a file must call invalidateFileInfo().
+     * Disabling the cache also clears it.
+     */
+    void setFileInfoCacheEnabled(bool enabled);
+    /// Forget the cached metadata of \p fileName.
+    void invalidateFileInfo(const std::string& fileName);
+    /// Forget the cached metadata of all files.
+    void invalidateFileInfo();
+
     /// Returns true if \p fileName exists.
     bool fileExists(const std::string& fileName);
     bool dirExists(const std::string& dirName);
     /// Removes a file from file system, returns true on success.
     bool rm(const std::string& fileName);
+    /// Copy \p source to \p dest, sharing the data blocks if the file system supports it, returns true on success.
+    /// The destination is written to a temporary file renamed over it, so it's never seen incomplete.
+    bool copyFile(const std::string& source, const std::string& dest);
+    /// Write \p data to \p fileName, replaced at once like by copyFile(), returns true on success.
+    bool writeFile(const std::string& fileName, const std::string& data);
+    /// Names of the entries in \p dir, empty if it can't be read.
+    StringList listDir(const std::string& dir);
     /// Returns the current process id
     unsigned long getPid();
     /// Returns the value of an environment variable.
@@ -57,8 +125,22 @@ namespace OS
     StringList getOSType();
 
     int numberOfCPUCores();
+    /// Memory in KiB available to start new processes without swapping, 0 if unknown.
+    unsigned long availableMemory();
+    /// System load average of the last minute, -1 if unknown.
+    double loadAverage();
+    /// Percentage of the last 10 seconds some task stalled waiting for memory, -1 if unknown.
+    double memoryPressure();
 
     unsigned long getTimeInMillis();
+    /// Monotonic time in microseconds, only meaningful to measure intervals.
+    unsigned long long getTimeInMicros();
+    /// Modification time of \p fileName in nanoseconds, 0 if it doesn't exist.
+    long long modificationTime(const std::string& fileName);
+    /// Size of \p fileName in bytes, 0 if it doesn't exist.
+    long long fileSize(const std::string& fileName);
+    /// Set the modification time of \p fileName, in nanoseconds, returns true on success.
+    bool setModificationTime(const std::string& fileName, long long time);
     /// return -x, 0 or +x if file1 is newer, same age or older than file2.
     /// i.e. file2.timestamp - file1.timestamp
     int timestampCompare(const std::string& file1, const std::string& file2);
@@ -76,6 +158,14 @@ namespace OS
     void uninstall(const std::string& file);
     std::string defaultInstallPrefix();
 
+    /// Enable the file metadata cache during the lifetime of this object.
+    class FileInfoCacheScope
+    {
+    public:
+        FileInfoCacheScope() { setFileInfoCacheEnabled(true); }
+        ~FileInfoCacheScope() { setFileInfoCacheEnabled(false); }
+    };
+
     class ChangeWorkingDirectory
     {
     public:
@@ -18,34 +18,79 @@
 
 #include "os.h"
 extern "C" {
+#include <spawn.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <dirent.h>
 #include <errno.h>
 #include <time.h>
 #include <signal.h>
 #include <string.h>
 }
 #include "logger.h"
+#include <atomic>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <functional>
 #include <libgen.h>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "stdstringsux.h"
 
+extern char** environ;
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+    #define HAVE_SPAWN_ADDCHDIR
+#endif
+
 namespace OS
 {
 
-int exec(const char* cmd, std::string* output, const char* workingDir, ExecOptions options)
+enum { READ, WRITE };
+
+static int readOutputAndWait(pid_t pid, int* out2me, std::string* output, ResourceUsage* usage = 0)
 {
-    enum { READ, WRITE };
+    int status;
+    if (output) {
+        close(out2me[WRITE]);
+        // Read straight into the output string, growing it as needed.
+        const size_t chunkSize = 64 * 1024;
+        size_t size = output->size();
+        ssize_t bytes;
+        do {
+            output->resize(size + chunkSize);
+            bytes = read(out2me[READ], &(*output)[size], chunkSize);
+            if (bytes > 0)
+                size += bytes;
+        } while (bytes > 0 || (bytes == -1 && errno == EINTR));
+        output->resize(size);
+        close(out2me[READ]);
+        trim(*output);
+    }
+    waitProcess(pid, &status, usage);
+    return status;
+}
 
+int exec(const char* cmd, std::string* output, const char* workingDir, ExecOptions options)
+{
     Debug() << cmd;
-    int status;
     int out2me[2];  // pipe from external program stdout to meique
-    if (output && pipe(out2me))
+    if (output && pipe2(out2me, O_CLOEXEC))
         throw Error("Unable to create unix pipes!");
 
     pid_t pid = fork();
@@ -65,62 +110,148 @@ int exec(const char* cmd, std::string* output, const char* workingDir, ExecOptio
         return 1;
     }
 
-    if (output) {
-        close(out2me[WRITE]);
-        char buffer[512];
-        int bytes;
-        while((bytes = read(out2me[READ], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes] = 0;
-            *output += buffer;
-        }
-        trim(*output);
-    }
-    waitpid(pid, &status, 0);
-    return status;
+    return readOutputAndWait(pid, out2me, output);
 }
 
-int exec(const std::string& cmd, const StringList& args, std::string* output, const std::string& workingDir, ExecOptions options)
+// Shell text is marked by this prefix, it can't be in a command line argument.
+static const char ShellTextMarker = '\x01';
+
+static bool needsShell(const std::string& arg)
 {
-    enum { READ, WRITE };
+    return arg.find_first_of("\"'\\$`*?[]{}|&;<>()~#!\n") != std::string::npos;
+}
 
-    std::string cmdline(cmd);
-    if (args.size())
-        cmdline += ' ' + join(args, " ");
+std::string shellText(const std::string& text)
+{
+    return needsShell(text) ? ShellTextMarker + text : text;
+}
 
-    Debug() << cmdline;
-    int status;
+static bool isShellText(const std::string& arg)
+{
+    return !arg.empty() && arg[0] == ShellTextMarker;
+}
+
+// Single quotes keep everything but other single quotes, these are closed, escaped and opened again.
+static std::string shellQuote(const std::string& arg)
+{
+    if (!arg.empty() && arg.find_first_of(" \t") == std::string::npos && !needsShell(arg))
+        return arg;
+    std::string quoted = "'";
+    for (char c : arg) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + '\'';
+}
+
+int exec(const StringList& args, std::string* output, const char* workingDir, ExecOptions options, ResourceUsage* usage)
+{
     int out2me[2];  // pipe from external program stdout to meique
-    if (output && pipe(out2me))
+    if (output && pipe2(out2me, O_CLOEXEC))
         throw Error("Unable to create unix pipes!");
 
-    pid_t pid = fork();
+    int outputFd = output ? out2me[WRITE] : -1;
+    int pid = spawn(args, workingDir, outputFd, options == OS::MergeErr ? outputFd : -1);
     if (pid == -1) {
-        throw Error("Error forking process to run: " + cmdline);
-    } else if (!pid) {
-        if (!workingDir.empty())
-            OS::cd(workingDir);
         if (output) {
             close(out2me[READ]);
-            dup2(out2me[WRITE], 1);
-            if (options == OS::MergeErr)
-                dup2(out2me[WRITE], 2);
+            close(out2me[WRITE]);
         }
-        execl("/usr/bin/env", "-i", "sh", "-c", cmdline.c_str(), (char*)0);
-        throw Error("Fatal error: shell not found!");
+        return 127;
     }
 
-    if (output) {
-        close(out2me[WRITE]);
-        char buffer[512];
-        int bytes;
-        while((bytes = read(out2me[READ], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes] = 0;
-            *output += buffer;
+    return readOutputAndWait(pid, out2me, output, usage);
+}
+
+int spawn(const StringList& args, const char* workingDir, int outputFd, int errorFd)
+{
+    std::string cmdline;
+    bool useShell = false;
+    for (const std::string& arg : args) {
+        if (!cmdline.empty())
+            cmdline += ' ';
+        if (isShellText(arg)) {
+            cmdline += arg.substr(1);
+            useShell = true;
+        } else {
+            cmdline += shellQuote(arg);
         }
-        trim(*output);
     }
-    waitpid(pid, &status, 0);
-    return status;
+    Debug() << cmdline;
+
+    StringList spawnArgs;
+    if (useShell) {
+        spawnArgs.push_back("/bin/sh");
+        spawnArgs.push_back("-c");
+        spawnArgs.push_back(cmdline);
+    } else {
+        spawnArgs = args;
+    }
+#ifndef HAVE_SPAWN_ADDCHDIR
+    // Let a shell change the directory, the arguments are passed untouched.
+    if (workingDir) {
+        spawnArgs.push_front(workingDir);
+        spawnArgs.push_front("cd \"$0\" && exec \"$@\"");
+        spawnArgs.push_front("-c");
+        spawnArgs.push_front("/bin/sh");
+    }
+#endif
+
+    std::vector<char*> argv;
+    for (const std::string& arg : spawnArgs)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(0);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+#ifdef HAVE_SPAWN_ADDCHDIR
+    if (workingDir)
+        posix_spawn_file_actions_addchdir_np(&actions, workingDir);
+#endif
+    if (outputFd != -1)
+        posix_spawn_file_actions_adddup2(&actions, outputFd, 1);
+    if (errorFd != -1)
+        posix_spawn_file_actions_adddup2(&actions, errorFd, 2);
+
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, 0, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error) {
+        std::cerr << "meique: error running " << args.front() << ": " << strerror(error) << std::endl;
+        return -1;
+    }
+    return pid;
+}
+
+int waitProcess(int pid, int* status, ResourceUsage* usage, bool block)
+{
+    struct rusage rusage;
+    pid_t res;
+    do {
+        res = wait4(pid, status, block ? 0 : WNOHANG, &rusage);
+    } while (res == -1 && errno == EINTR);
+
+    if (res > 0 && usage) {
+        usage->userTime = rusage.ru_utime.tv_sec * 1000 + rusage.ru_utime.tv_usec / 1000;
+        usage->systemTime = rusage.ru_stime.tv_sec * 1000 + rusage.ru_stime.tv_usec / 1000;
+        usage->peakMemory = rusage.ru_maxrss;
+        usage->blockInputs = rusage.ru_inblock;
+        usage->blockOutputs = rusage.ru_oublock;
+        usage->voluntaryContextSwitches = rusage.ru_nvcsw;
+        usage->involuntaryContextSwitches = rusage.ru_nivcsw;
+    }
+    return res;
+}
+
+int processFd(int pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
 }
 
 void cd(const char* dir)
@@ -139,6 +270,64 @@ std::string pwd()
     return result;
 }
 
+struct FileInfo
+{
+    bool exists;
+    bool isFile;
+    bool isDir;
+    long long modificationTime;
+    long long size;
+};
+
+static bool fileInfoCacheEnabled = false;
+static std::mutex fileInfoMutex;
+static std::unordered_map<std::string, FileInfo> fileInfoCache;
+
+static FileInfo fileInfo(const std::string& fileName)
+{
+    // Relative paths depend on the current directory, changed by Lua jobs, so they aren't cached.
+    const bool useCache = fileInfoCacheEnabled && !fileName.empty() && fileName[0] == '/';
+    if (useCache) {
+        std::lock_guard<std::mutex> lock(fileInfoMutex);
+        auto it = fileInfoCache.find(fileName);
+        if (it != fileInfoCache.end())
+            return it->second;
+    }
+
+    FileInfo info;
+    struct stat fileStat;
+    info.exists = ::stat(fileName.c_str(), &fileStat) == 0;
+    info.isFile = info.exists && S_ISREG(fileStat.st_mode);
+    info.isDir = info.exists && S_ISDIR(fileStat.st_mode);
+    info.modificationTime = info.exists ? fileStat.st_mtim.tv_sec * 1000000000ll + fileStat.st_mtim.tv_nsec : 0;
+    info.size = info.isFile ? fileStat.st_size : 0;
+
+    if (useCache) {
+        std::lock_guard<std::mutex> lock(fileInfoMutex);
+        fileInfoCache[fileName] = info;
+    }
+    return info;
+}
+
+void setFileInfoCacheEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(fileInfoMutex);
+    fileInfoCacheEnabled = enabled;
+    fileInfoCache.clear();
+}
+
+void invalidateFileInfo(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(fileInfoMutex);
+    fileInfoCache.erase(fileName);
+}
+
+void invalidateFileInfo()
+{
+    std::lock_guard<std::mutex> lock(fileInfoMutex);
+    fileInfoCache.clear();
+}
+
 static void meiqueMkdir(const std::string& dir)
 {
     const char ERROR_MSG[] = "Internal error creating directory ";
@@ -153,6 +342,8 @@ static void meiqueMkdir(const std::string& dir)
         if (::mkdir(dir.c_str(), 0755) == -1)
             throw Error(ERROR_MSG + dir + '.');
     }
+    invalidateFileInfo(dir);
+    invalidateFileInfo(dir + '/');
 }
 
 void mkdir(const std::string& dir)
@@ -167,26 +358,94 @@ void mkdir(const std::string& dir)
 
 bool fileExists(const std::string& fileName)
 {
-    struct stat fileAtt;
-    if (::stat(fileName.c_str(), &fileAtt) != 0)
-        return false;
-    return S_ISREG(fileAtt.st_mode);
+    return fileInfo(fileName).isFile;
 }
 
 bool dirExists(const std::string& fileName)
 {
-    struct stat fileAtt;
-    if (::stat(fileName.c_str(), &fileAtt) != 0)
-        return false;
-    return S_ISDIR(fileAtt.st_mode);
+    return fileInfo(fileName).isDir;
 }
 
 bool rm(const std::string& fileName)
 {
     Debug() << "rm " << fileName;
+    invalidateFileInfo(fileName);
     return !::unlink(fileName.c_str());
 }
 
+// Write \p dest with \p write through a temporary file renamed over it, so nobody sees it incomplete.
+// The old file is never written into, it may be a hard link to something else.
+static bool replaceFile(const std::string& dest, const std::function<bool(int fd)>& write)
+{
+    static std::atomic<unsigned> counter(0);
+    const std::string tmpFile = dest + ".tmp" + std::to_string(::getpid()) + '.' + std::to_string(counter++);
+    int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+    bool ok = write(fd);
+    ok = !::close(fd) && ok;
+    ok = ok && !::rename(tmpFile.c_str(), dest.c_str());
+    if (!ok)
+        ::unlink(tmpFile.c_str());
+    invalidateFileInfo(dest);
+    return ok;
+}
+
+bool copyFile(const std::string& source, const std::string& dest)
+{
+    int sourceFd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (sourceFd == -1)
+        return false;
+
+    const bool ok = replaceFile(dest, [sourceFd](int destFd) {
+#ifdef FICLONE
+        // Copy on write file systems can share the data blocks instead of copying them.
+        if (::ioctl(destFd, FICLONE, sourceFd) == 0)
+            return true;
+#endif
+        char buffer[64 * 1024];
+        ssize_t bytes;
+        bool ok = true;
+        while (ok && (bytes = ::read(sourceFd, buffer, sizeof(buffer))) > 0)
+            ok = ::write(destFd, buffer, bytes) == bytes;
+        return ok && bytes == 0;
+    });
+    ::close(sourceFd);
+    return ok;
+}
+
+bool writeFile(const std::string& fileName, const std::string& data)
+{
+    return replaceFile(fileName, [&data](int fd) {
+        const char* pos = data.data();
+        size_t size = data.size();
+        while (size) {
+            ssize_t bytes = ::write(fd, pos, size);
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+                return false;
+            pos += bytes;
+            size -= bytes;
+        }
+        return true;
+    });
+}
+
+StringList listDir(const std::string& dir)
+{
+    StringList entries;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d)
+        return entries;
+    while (dirent* entry = ::readdir(d)) {
+        if (std::strcmp(entry->d_name, ".") && std::strcmp(entry->d_name, ".."))
+            entries.push_back(entry->d_name);
+    }
+    ::closedir(d);
+    return entries;
+}
+
 unsigned long getPid()
 {
     return ::getpid();
@@ -233,6 +492,13 @@ unsigned long getTimeInMillis()
     return t.tv_sec * 1000 + t.tv_usec/1000;
 }
 
+unsigned long long getTimeInMicros()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
 const char PathSep = '/';
 
 static std::string normalizePath(const std::string& path)
@@ -316,20 +582,71 @@ std::string defaultInstallPrefix()
     return "/usr/";
 }
 
+long long modificationTime(const std::string& fileName)
+{
+    return fileInfo(fileName).modificationTime;
+}
+
+long long fileSize(const std::string& fileName)
+{
+    return fileInfo(fileName).size;
+}
+
+bool setModificationTime(const std::string& fileName, long long time)
+{
+    invalidateFileInfo(fileName);
+    timespec times[2];
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = time / 1000000000;
+    times[1].tv_nsec = time % 1000000000;
+    return !utimensat(AT_FDCWD, fileName.c_str(), times, 0);
+}
+
 int timestampCompare(const std::string& file1, const std::string& file2)
 {
-    struct stat file1Stat;
-    struct stat file2Stat;
-    if (::stat(file1.c_str(), &file1Stat) != 0)
+    FileInfo file1Info = fileInfo(file1);
+    if (!file1Info.exists)
         return -1;
-    if (::stat(file2.c_str(), &file2Stat) != 0)
+    FileInfo file2Info = fileInfo(file2);
+    if (!file2Info.exists)
         return -1;
 
-    return file2Stat.st_mtime - file1Stat.st_mtime;
+    // Compare the sign only, nanoseconds don't fit in an int.
+    const long long diff = file2Info.modificationTime - file1Info.modificationTime;
+    return diff < 0 ? -1 : (diff > 0 ? 1 : 0);
 }
 
 int numberOfCPUCores()
 {
     return std::max(1l, sysconf(_SC_NPROCESSORS_ONLN));
 }
+
+unsigned long availableMemory()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    unsigned long value;
+    while (meminfo >> key >> value) {
+        if (key == "MemAvailable:")
+            return value;
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+double loadAverage()
+{
+    double load;
+    return getloadavg(&load, 1) == 1 ? load : -1;
+}
+
+double memoryPressure()
+{
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::ifstream pressure("/proc/pressure/memory");
+    std::string line;
+    if (!std::getline(pressure, line) || line.compare(0, 11, "some avg10=") != 0)
+        return -1;
+    return std::strtod(line.c_str() + 11, 0);
+}
 }
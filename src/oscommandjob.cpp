@@ -18,14 +18,180 @@
 
 #include "oscommandjob.h"
 #include "os.h"
+#include "logger.h"
 
-OSCommandJob::OSCommandJob(NodeGuard* nodeGuard, const std::string& command)
+#include <cassert>
+
+extern "C" {
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+}
+
+// Output bigger than this goes to a temporary file.
+static const size_t MaxOutputInMemory = 1024 * 1024;
+
+static void writeAll(int fd, const char* data, size_t size)
+{
+    while (size) {
+        ssize_t bytes = ::write(fd, data, size);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return;
+        data += bytes;
+        size -= bytes;
+    }
+}
+
+JobOutput::JobOutput()
+    : m_spillFd(-1)
+    , m_size(0)
+{
+}
+
+JobOutput::~JobOutput()
+{
+    if (m_spillFd != -1)
+        close(m_spillFd);
+}
+
+void JobOutput::append(const char* data, size_t size)
+{
+    m_size += size;
+    if (m_spillFd == -1 && m_buffer.size() + size > MaxOutputInMemory)
+        spill();
+
+    if (m_spillFd != -1)
+        writeAll(m_spillFd, data, size);
+    else
+        m_buffer.append(data, size);
+}
+
+void JobOutput::spill()
+{
+    std::string tmpDir = OS::getEnv("TMPDIR");
+    std::string fileName = (tmpDir.empty() ? std::string("/tmp") : tmpDir) + "/meique-output-XXXXXX";
+    m_spillFd = mkostemp(&fileName[0], O_CLOEXEC);
+    // Keep it in memory if we can't have a temporary file.
+    if (m_spillFd == -1)
+        return;
+    unlink(fileName.c_str());
+    writeAll(m_spillFd, m_buffer.data(), m_buffer.size());
+    std::string().swap(m_buffer);
+}
+
+void JobOutput::writeTo(int fd)
+{
+    if (m_spillFd == -1) {
+        writeAll(fd, m_buffer.data(), m_buffer.size());
+        return;
+    }
+
+    char buffer[64 * 1024];
+    ssize_t bytes;
+    lseek(m_spillFd, 0, SEEK_SET);
+    while ((bytes = read(m_spillFd, buffer, sizeof(buffer))) > 0)
+        writeAll(fd, buffer, bytes);
+}
+
+OSCommandJob::OSCommandJob(NodeGuard* nodeGuard, const StringList& args)
     : Job(nodeGuard)
-    , m_command(command)
+    , m_args(args)
+    , m_pid(-1)
+    , m_exited(false)
+    , m_exitStatus(0)
+{
+    m_outputFds[0] = m_outputFds[1] = -1;
+}
+
+OSCommandJob::~OSCommandJob()
+{
+    closeOutput(m_outputFds[0]);
+    closeOutput(m_outputFds[1]);
+}
+
+bool OSCommandJob::runPrelude()
+{
+    setStarted();
+    if (!m_prelude || !m_prelude())
+        return false;
+    setFinished(0);
+    return true;
+}
+
+bool OSCommandJob::start()
+{
+    if (!startTime())
+        setStarted();
+
+    int pipes[2][2];
+    for (int i = 0; i < 2; ++i) {
+        if (pipe2(pipes[i], O_CLOEXEC)) {
+            if (i)
+                close(pipes[0][1]);
+            throw Error("Unable to create unix pipes!");
+        }
+        // Only our side is non blocking, the child process must block if the pipe is full.
+        fcntl(pipes[i][0], F_SETFL, O_NONBLOCK);
+        m_outputFds[i] = pipes[i][0];
+    }
+
+    m_pid = OS::spawn(m_args, workingDirectory().c_str(), pipes[0][1], pipes[1][1]);
+    close(pipes[0][1]);
+    close(pipes[1][1]);
+    return m_pid != -1;
+}
+
+bool OSCommandJob::readOutput(int fd)
+{
+    JobOutput& output = m_output[fd == m_outputFds[0] ? 0 : 1];
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            output.append(buffer, bytes);
+        } else if (bytes == -1 && errno == EINTR) {
+            continue;
+        } else {
+            return bytes == -1 && errno == EAGAIN;
+        }
+    }
+}
+
+void OSCommandJob::setExitStatus(int status, const OS::ResourceUsage& usage)
+{
+    m_exited = true;
+    m_exitStatus = status;
+    m_exitUsage = usage;
+}
+
+void OSCommandJob::finish()
+{
+    for (int fd : m_outputFds) {
+        if (fd != -1)
+            readOutput(fd);
+    }
+    setResourceUsage(m_exitUsage);
+    setFinished(m_exitStatus);
+}
+
+void OSCommandJob::flushOutput()
+{
+    m_output[0].writeTo(1);
+    m_output[1].writeTo(2);
+}
+
+void OSCommandJob::closeOutput(int fd)
 {
+    if (fd != -1)
+        close(fd);
 }
 
 int OSCommandJob::doRun()
 {
-    return OS::exec(m_command, 0, workingDirectory().c_str());
+    // The JobManager runs the prelude and starts the process itself, watching it from its event loop.
+    assert(false && "OSCommandJob must be run by the JobManager");
+    return 1;
 }
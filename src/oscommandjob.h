@@ -20,16 +20,90 @@
 #define OSCOMMANDJOB_H
 
 #include "job.h"
+#include "basictypes.h"
 
+/**
+ * Output of a process, kept in memory until it's flushed.
+ *
+ * If the output grows too much it's moved to an unlinked temporary file.
+ */
+class JobOutput
+{
+public:
+    JobOutput();
+    ~JobOutput();
+
+    void append(const char* data, size_t size);
+    bool empty() const { return !m_size; }
+    /// Write all the output to \p fd.
+    void writeTo(int fd);
+
+    JobOutput(const JobOutput&) = delete;
+    JobOutput& operator=(const JobOutput&) = delete;
+private:
+    std::string m_buffer;
+    int m_spillFd;
+    size_t m_size;
+
+    void spill();
+};
+
+/**
+ * Job running an external program.
+ *
+ * The process is started with start(), its output read with readOutput(), its exit recorded with
+ * setExitStatus() and the job finished with finish(), so the JobManager can watch it without blocking
+ * a thread and run the success callback, that may do a lot of IO, in a worker thread.
+ *
+ * The process standard output and error are captured, so the output of jobs running at the same time
+ * doesn't get mixed, and written at once by flushOutput() when the job finishes.
+ *
+ * A job may have a prelude, run in a worker thread before the process is started, that can make
+ * the process unnecessary, e.g. by fetching the outputs from a remote cache.
+ */
 class OSCommandJob : public Job
 {
 public:
-    OSCommandJob(NodeGuard* nodeGuard, const std::string& command);
+    OSCommandJob(NodeGuard* nodeGuard, const StringList& args);
+    ~OSCommandJob();
+
+    /// \p prelude returns true if the job is already done and the process doesn't need to be run.
+    void setPrelude(const std::function<bool()>& prelude) { m_prelude = prelude; }
+    bool hasPrelude() const { return !!m_prelude; }
+    /// Run the prelude in the current thread, returns true and finishes the job if the process isn't needed.
+    bool runPrelude();
+    /// Spawn the process, returns false on errors.
+    bool start();
+    int pid() const { return m_pid; }
+    /// Read end of the pipes connected to the process standard output and error.
+    int outputFd() const { return m_outputFds[0]; }
+    int errorFd() const { return m_outputFds[1]; }
+    /// Read what is available on \p fd, returns false when the pipe is closed.
+    bool readOutput(int fd);
+    /// Must be called after the process exit with its exit \p status and the resources it used.
+    void setExitStatus(int status, const OS::ResourceUsage& usage);
+    bool hasExited() const { return m_exited; }
+    /// Finish the job with the status given to setExitStatus(), running its success callback.
+    void finish();
+    /// True if the process wrote something to its standard output or error.
+    bool hasOutput() const { return !m_output[0].empty() || !m_output[1].empty(); }
+    /// Write the captured output to meique standard output and error.
+    void flushOutput();
 
 protected:
+    /// Never called, the JobManager runs the prelude and starts the process, see runPrelude() and start().
     virtual int doRun();
 private:
-    std::string m_command;
+    StringList m_args;
+    std::function<bool()> m_prelude;
+    int m_pid;
+    int m_outputFds[2];
+    bool m_exited;
+    int m_exitStatus;
+    OS::ResourceUsage m_exitUsage;
+    JobOutput m_output[2];
+
+    void closeOutput(int fd);
 };
 
 #endif // OSCOMMANDJOB_H
@@ -0,0 +1,363 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "remotecache.h"
+#include "depslog.h"
+#include "logger.h"
+#include "os.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+// Seconds waiting for the server before giving up on the remote cache.
+static const int Timeout = 10;
+// Older entries of a manifest are dropped, they were probably made with outdated headers.
+static const size_t MaxManifestEntries = 32;
+static const size_t MaxHeaderSize = 64 * 1024;
+// Uploads queued when the server is slower than the build are dropped, they're just a missed cache entry.
+static const size_t MaxQueuedUploads = 256;
+
+static std::string hex(uint64_t value)
+{
+    char str[17];
+    std::snprintf(str, sizeof(str), "%016llx", static_cast<unsigned long long>(value));
+    return str;
+}
+
+static bool isSuccess(int status)
+{
+    return status >= 200 && status < 300;
+}
+
+RemoteCache::RemoteCache(const std::string& url)
+    : m_disabled(false)
+    , m_stopUploading(false)
+    , m_hits(0)
+    , m_misses(0)
+    , m_uploaded(0)
+    , m_dropped(0)
+{
+    if (url.compare(0, 5, "unix:") == 0) {
+        m_socketPath = url.substr(5);
+        m_host = "localhost";
+    } else if (url.compare(0, 7, "http://") == 0) {
+        const size_t slash = url.find('/', 7);
+        const std::string hostPort = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+        if (slash != std::string::npos)
+            m_prefix = url.substr(slash);
+        while (!m_prefix.empty() && m_prefix[m_prefix.size() - 1] == '/')
+            m_prefix.erase(m_prefix.size() - 1);
+        const size_t colon = hostPort.rfind(':');
+        m_host = hostPort.substr(0, colon);
+        m_port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+    }
+    if (m_host.empty() || (m_socketPath.empty() && m_port.empty()))
+        throw Error("Invalid remote cache URL " + url + ", use http://HOST[:PORT][/PREFIX] or unix:PATH.");
+
+    m_uploadThread = std::thread(&RemoteCache::uploadLoop, this);
+}
+
+RemoteCache::~RemoteCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopUploading = true;
+        if (!m_uploads.empty())
+            Notice() << "Waiting for " << m_uploads.size() << " uploads to the remote cache...";
+    }
+    m_uploadsCond.notify_one();
+    m_uploadThread.join();
+
+    for (int fd : m_idleConnections)
+        ::close(fd);
+    Debug() << "Remote cache: " << m_hits << " hits, " << m_misses << " misses, " << m_uploaded << " objects uploaded, "
+            << m_dropped << " uploads dropped.";
+}
+
+void RemoteCache::disable(const std::string& reason)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_disabled)
+        return;
+    m_disabled = true;
+    Warn() << "Remote cache disabled, " << reason;
+}
+
+int RemoteCache::connect()
+{
+    int fd = -1;
+    if (!m_socketPath.empty()) {
+        sockaddr_un address;
+        if (m_socketPath.size() >= sizeof(address.sun_path))
+            return -1;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, m_socketPath.c_str());
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+            ::close(fd);
+            fd = -1;
+        }
+    } else {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses;
+        if (::getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &addresses))
+            return -1;
+        for (addrinfo* address = addresses; address && fd == -1; address = address->ai_next) {
+            fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd != -1 && ::connect(fd, address->ai_addr, address->ai_addrlen)) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(addresses);
+        if (fd != -1) {
+            int enabled = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        }
+    }
+
+    if (fd != -1) {
+        timeval timeout = { Timeout, 0 };
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+int RemoteCache::request(const char* method, const std::string& path, const std::string& body, std::string* response)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_disabled)
+            return -1;
+    }
+
+    std::ostringstream request;
+    request << method << ' ' << m_prefix << path << " HTTP/1.1\r\nHost: " << m_host
+            << "\r\nContent-Length: " << body.size() << "\r\n\r\n" << body;
+
+    // The server may have closed a kept alive connection, so try again with a new one.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_idleConnections.empty()) {
+                fd = m_idleConnections.back();
+                m_idleConnections.pop_back();
+            }
+        }
+        const bool reused = fd != -1;
+        if (!reused)
+            fd = connect();
+        if (fd == -1)
+            break;
+
+        bool keepAlive;
+        const int status = sendRequest(fd, request.str(), response, &keepAlive);
+        if (status != -1) {
+            if (keepAlive) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_idleConnections.push_back(fd);
+            } else {
+                ::close(fd);
+            }
+            return status;
+        }
+        ::close(fd);
+        if (!reused)
+            break;
+    }
+    disable("unable to talk with " + (m_socketPath.empty() ? m_host + ':' + m_port : m_socketPath) + '.');
+    return -1;
+}
+
+int RemoteCache::sendRequest(int fd, const std::string& request, std::string* response, bool* keepAlive)
+{
+    for (size_t sent = 0; sent < request.size();) {
+        ssize_t bytes = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (bytes <= 0)
+            return -1;
+        sent += bytes;
+    }
+
+    std::string data;
+    char buffer[64 * 1024];
+    size_t headerEnd;
+    while ((headerEnd = data.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t bytes = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes <= 0 || data.size() > MaxHeaderSize)
+            return -1;
+        data.append(buffer, bytes);
+    }
+
+    // Status line and headers, only Content-Length and Connection matter.
+    std::istringstream headers(data.substr(0, headerEnd));
+    std::string line;
+    int status = -1;
+    size_t contentLength = 0;
+    *keepAlive = true;
+    if (!std::getline(headers, line) || std::sscanf(line.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    while (std::getline(headers, line)) {
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        for (char& c : name)
+            c = std::tolower(c);
+        const std::string value = line.substr(colon + 1);
+        if (name == "content-length")
+            contentLength = std::strtoull(value.c_str(), 0, 10);
+        else if (name == "connection" && value.find("close") != std::string::npos)
+            *keepAlive = false;
+    }
+
+    data.erase(0, headerEnd + 4);
+    while (data.size() < contentLength) {
+        ssize_t bytes = ::recv(fd, buffer, std::min(sizeof(buffer), contentLength - data.size()), 0);
+        if (bytes <= 0)
+            return -1;
+        data.append(buffer, bytes);
+    }
+    if (response)
+        response->swap(data);
+    return status;
+}
+
+bool RemoteCache::fetch(uint64_t key, const std::string& output, DepsLog& depsLog)
+{
+    std::string data;
+    const ObjectCache::ManifestEntry* entry = nullptr;
+    ObjectCache::Manifest manifest;
+    if (request("GET", "/m/" + hex(key), std::string(), &data) == 200) {
+        std::istringstream in(data);
+        manifest = ObjectCache::parseManifest(in);
+        entry = ObjectCache::findEntry(manifest, depsLog);
+    }
+
+    const bool written = entry && request("GET", "/o/" + hex(entry->object), std::string(), &data) == 200
+                         && OS::writeFile(output, data);
+    if (!written) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_misses++;
+        return false;
+    }
+
+    ObjectCache::writeDepFile(output, *entry);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hits++;
+    return true;
+}
+
+void RemoteCache::store(uint64_t key, const std::string& output, DepsLog& depsLog)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_disabled)
+            return;
+    }
+
+    // The object is read by the upload thread, it's only uploaded if it wasn't compiled again meanwhile.
+    Upload upload;
+    upload.key = key;
+    upload.output = output;
+    upload.outputTime = OS::modificationTime(output);
+    if (!upload.outputTime || !ObjectCache::createEntry(key, output, depsLog, upload.entry))
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_uploads.size() >= MaxQueuedUploads) {
+        m_dropped++;
+        return;
+    }
+    m_uploads.push_back(std::move(upload));
+    m_uploadsCond.notify_one();
+}
+
+void RemoteCache::uploadLoop()
+{
+    while (true) {
+        Upload upload;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_uploadsCond.wait(lock, [&] { return !m_uploads.empty() || m_stopUploading; });
+            if (m_uploads.empty())
+                return;
+            upload = std::move(m_uploads.front());
+            m_uploads.pop_front();
+        }
+        this->upload(upload);
+    }
+}
+
+void RemoteCache::upload(const Upload& upload)
+{
+    std::ifstream file(upload.output.c_str(), std::ios::binary);
+    std::ostringstream object;
+    if (!(object << file.rdbuf()))
+        return;
+    // Compiled again since it was queued, it may not match the manifest entry anymore.
+    OS::invalidateFileInfo(upload.output);
+    if (OS::modificationTime(upload.output) != upload.outputTime)
+        return;
+
+    // The object goes first, so nobody finds a manifest entry without its object.
+    if (!isSuccess(request("PUT", "/o/" + hex(upload.entry.object), object.str(), nullptr)))
+        return;
+
+    std::string data;
+    ObjectCache::Manifest manifest;
+    if (request("GET", "/m/" + hex(upload.key), std::string(), &data) == 200) {
+        std::istringstream in(data);
+        manifest = ObjectCache::parseManifest(in);
+    }
+    for (const ObjectCache::ManifestEntry& entry : manifest) {
+        if (entry.object == upload.entry.object)
+            return;
+    }
+
+    data.clear();
+    const size_t first = manifest.size() >= MaxManifestEntries ? manifest.size() - MaxManifestEntries + 1 : 0;
+    for (size_t i = first; i < manifest.size(); ++i)
+        data += ObjectCache::serializeEntry(manifest[i]);
+    data += ObjectCache::serializeEntry(upload.entry);
+    if (!isSuccess(request("PUT", "/m/" + hex(upload.key), data, nullptr)))
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_uploaded++;
+}
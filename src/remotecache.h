@@ -0,0 +1,93 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REMOTECACHE_H
+#define REMOTECACHE_H
+
+#include "objectcache.h"
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DepsLog;
+
+/**
+ * Object cache shared by many machines, stored by a server as content addressed blobs.
+ *
+ * The protocol is plain HTTP/1.1 with persistent connections, over TCP or a Unix socket. A GET of
+ * /m/KEY returns the manifest of a compilation key, in the same format used by ObjectCache, and a GET
+ * of /o/HASH returns an object. Both are stored with PUT. Any other status than 200 is a miss.
+ *
+ * Lookups block the calling thread, so they are done in the job slot of the compilation. Objects
+ * compiled after a miss are read and uploaded by a background thread, the destructor waits for the
+ * pending uploads. If too many uploads are pending new ones are dropped. After a connection error
+ * the cache is disabled for the rest of the build. All methods are thread safe.
+ */
+class RemoteCache
+{
+public:
+    /// \p url is http://HOST[:PORT][/PREFIX] or unix:PATH.
+    RemoteCache(const std::string& url);
+    ~RemoteCache();
+
+    /// Download the object compiled for \p key into \p output, with its dependency file, returns false on misses.
+    bool fetch(uint64_t key, const std::string& output, DepsLog& depsLog);
+    /// Queue the upload of \p output, compiled for \p key, with the dependencies recorded in \p depsLog.
+    void store(uint64_t key, const std::string& output, DepsLog& depsLog);
+
+    RemoteCache(const RemoteCache&) = delete;
+    RemoteCache& operator=(const RemoteCache&) = delete;
+private:
+    struct Upload {
+        uint64_t key;
+        ObjectCache::ManifestEntry entry;
+        std::string output;
+        long long outputTime;
+    };
+
+    std::string m_host;
+    std::string m_port;
+    std::string m_socketPath;
+    std::string m_prefix;
+
+    std::mutex m_mutex;
+    std::condition_variable m_uploadsCond;
+    std::deque<Upload> m_uploads;
+    std::vector<int> m_idleConnections;
+    bool m_disabled;
+    bool m_stopUploading;
+    unsigned m_hits;
+    unsigned m_misses;
+    unsigned m_uploaded;
+    unsigned m_dropped;
+    std::thread m_uploadThread;
+
+    /// Send a request, returning the HTTP status or -1 on connection errors.
+    int request(const char* method, const std::string& path, const std::string& body, std::string* response);
+    int sendRequest(int fd, const std::string& request, std::string* response, bool* keepAlive);
+    int connect();
+    void disable(const std::string& reason);
+    void uploadLoop();
+    void upload(const Upload& upload);
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracer.h"
+#include "logger.h"
+#include "os.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace Tracer
+{
+
+static std::string traceFile;
+static unsigned long long startTime = 0;
+static std::mutex eventsMutex;
+static std::vector<std::string> events;
+static int maxSlot = -1;
+
+static std::string jsonEscape(const std::string& str)
+{
+    std::string result;
+    result.reserve(str.size());
+    for (char c : str) {
+        switch (c) {
+        case '"':
+        case '\\':
+            result += '\\';
+            result += c;
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) >= 0x20)
+                result += c;
+        }
+    }
+    return result;
+}
+
+void enable(const std::string& fileName)
+{
+    traceFile = fileName;
+    startTime = OS::getTimeInMicros();
+}
+
+bool isEnabled()
+{
+    return !traceFile.empty();
+}
+
+void addEvent(const std::string& name, const char* category, unsigned long long start, unsigned long long end,
+              int slot, const StringMap& args)
+{
+    if (!isEnabled())
+        return;
+
+    std::ostringstream event;
+    event << "{\"name\": \"" << jsonEscape(name) << "\", \"cat\": \"" << category << "\", \"ph\": \"X\", "
+          << "\"ts\": " << (start > startTime ? start - startTime : 0) << ", "
+          << "\"dur\": " << (end > start ? end - start : 0) << ", "
+          << "\"pid\": 1, \"tid\": " << slot + 1;
+    if (!args.empty()) {
+        event << ", \"args\": {";
+        const char* separator = "";
+        for (auto& pair : args) {
+            event << separator << '"' << jsonEscape(pair.first) << "\": \"" << jsonEscape(pair.second) << '"';
+            separator = ", ";
+        }
+        event << '}';
+    }
+    event << '}';
+
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    events.push_back(event.str());
+    maxSlot = std::max(maxSlot, slot);
+}
+
+void save()
+{
+    if (!isEnabled())
+        return;
+
+    std::ofstream file(traceFile.c_str());
+    if (!file) {
+        Warn() << "Unable to write trace file " << traceFile << '.';
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    file << "[\n";
+    // Name the rows shown by the trace viewer.
+    for (int slot = -1; slot <= maxSlot; ++slot) {
+        file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << slot + 1 << ", \"args\": {\"name\": \"";
+        if (slot == -1)
+            file << "meique";
+        else
+            file << "slot " << slot + 1;
+        file << "\"}}";
+        file << (slot < maxSlot || !events.empty() ? ",\n" : "\n");
+    }
+    for (size_t i = 0; i < events.size(); ++i)
+        file << events[i] << (i + 1 < events.size() ? ",\n" : "\n");
+    file << "]\n";
+}
+
+}
+
+TraceScope::TraceScope(const char* name, const std::string& detail)
+    : m_name(name)
+    , m_detail(detail)
+    , m_start(Tracer::isEnabled() ? OS::getTimeInMicros() : 0)
+{
+}
+
+TraceScope::~TraceScope()
+{
+    if (!Tracer::isEnabled())
+        return;
+    StringMap args;
+    if (!m_detail.empty())
+        args["detail"] = m_detail;
+    Tracer::addEvent(m_name, "meique", m_start, OS::getTimeInMicros(), -1, args);
+}
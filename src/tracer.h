@@ -0,0 +1,62 @@
+/*
+    This file is part of the Meique project
+    Copyright (C) 2014 Hugo Parente Lima <hugo.pl@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "basictypes.h"
+
+/**
+ * Records a trace of the build in the Chrome trace event format, to be loaded in chrome://tracing.
+ *
+ * Tracing is disabled unless enable() is called, when disabled nothing is recorded.
+ * Times are in microseconds as returned by OS::getTimeInMicros().
+ */
+namespace Tracer
+{
+    /// Start recording events, they are written to \p fileName by save().
+    void enable(const std::string& fileName);
+    bool isEnabled();
+
+    /**
+     * Record something that happened between \p start and \p end.
+     *
+     * \p slot is the job slot used, or -1 for meique's own work.
+     */
+    void addEvent(const std::string& name, const char* category, unsigned long long start, unsigned long long end,
+                  int slot = -1, const StringMap& args = StringMap());
+    /// Write all recorded events to the trace file.
+    void save();
+}
+
+/// Record a meique phase lasting from the creation to the destruction of this object.
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const std::string& detail = std::string());
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+private:
+    const char* m_name;
+    std::string m_detail;
+    unsigned long long m_start;
+};
+
+#endif
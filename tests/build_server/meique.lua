@@ -0,0 +1,2 @@
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
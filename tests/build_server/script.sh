@@ -0,0 +1,37 @@
+# Stop the build server started by the test when it ends.
+stopServer()
+{
+    for proc in /proc/[0-9]*; do
+        [ "`readlink $proc/cwd`" = "$PWD" ] && grep -q -- "--server" $proc/cmdline 2>/dev/null && kill ${proc#/proc/}
+    done
+}
+trap stopServer EXIT
+
+$MEIQUE -s .. || fail "Failed to configure."
+export REAL_CXX=`command -v g++`
+export PATH=$PWD/../bin:$PATH
+
+# The header is saved while main.cpp is compiled with its old contents.
+touch ../hold
+$MEIQUE --server=1 > output.log 2>&1 &
+CLIENT=$!
+for i in `seq 100`; do
+    [ -f ../compiling ] && break
+    sleep 0.1
+done
+[ -f ../compiling ] || { kill $CLIENT; cat output.log; fail "main.cpp wasn't compiled."; }
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../header.h
+rm ../hold
+wait $CLIENT || { cat output.log; fail "Failed to compile."; }
+cat output.log
+[ `./exe` = "ORIGINAL" ] || fail "exe should have the contents of the header when it was compiled."
+
+$MEIQUE --server=1 > output.log 2>&1 || { cat output.log; fail "Failed to compile after changing the header."; }
+cat output.log
+grep "Compiling main.cpp" output.log || fail "main.cpp should be compiled again, the header changed during the last build."
+[ `./exe` = "MODIFIED" ] || fail "exe wasn't rebuilt."
+
+$MEIQUE --server=1 > output.log 2>&1 || { cat output.log; fail "Failed to run a no-op build."; }
+grep "Compiling\|Linking" output.log && fail "Nothing should be built."
+exit 0
@@ -9,3 +9,20 @@ if [ "$EXE" != "Changed" ]
 then
     fail "main.cpp compilation not triggered after compiler command line modification."
 fi
+
+# A linker command change must relink the target without compiling its objects again.
+OBJECT_TIME=`stat -c %Y main.c.exe.o`
+EXE_TIME=`stat -c %Y exe`
+sleep 1
+echo "exe:addLibraryPath('/tmp')" >> ../meique.lua
+
+$MEIQUE || fail "Build after linker command change failed."
+
+if [ `stat -c %Y main.c.exe.o` != $OBJECT_TIME ]
+then
+    fail "main.c compiled again after a linker command line modification."
+fi
+if [ `stat -c %Y exe` = $EXE_TIME ]
+then
+    fail "exe not linked again after a linker command line modification."
+fi
@@ -0,0 +1,7 @@
+#include <iostream>
+#include "gen.h"
+
+int main()
+{
+    std::cout << MESSAGE;
+}
@@ -0,0 +1,18 @@
+gen = CustomTarget:new("gen", function()
+    local input = io.open("gen.in")
+    local output = io.open(buildDir().."gen.h", "w")
+    for line in input:lines() do
+        if line:find("^#define") then
+            output:write(line.."\n")
+        end
+    end
+    input:close()
+    output:close()
+end)
+gen:addFile("gen.in")
+gen:addOutput("gen.h")
+gen:setRestat()
+
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
+exe:addDependency(gen)
@@ -0,0 +1,23 @@
+$MEIQUE .. || fail "Failed to compile."
+EXE_TIME=`stat -c %Y exe`
+
+# The generator runs again, but produces the same gen.h, so exe must not be rebuilt.
+sleep 1
+echo "// A comment that isn't copied" >> ../gen.in
+
+$MEIQUE || fail "Build after changing the generator input failed."
+if [ `stat -c %Y exe` != $EXE_TIME ]
+then
+    fail "The target was rebuilt, but the generated header didn't change."
+fi
+
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../gen.in
+
+$MEIQUE || fail "Build after changing the generated header failed."
+
+EXE=`./exe` || fail "Target not compiled!?"
+if [ $EXE != "MODIFIED" ]
+then
+    fail "The target should be rebuilt after the generated header changed, but wasn't."
+fi
@@ -0,0 +1,28 @@
+$MEIQUE .. || fail "Failed to compile."
+[ -f meiquedeps.bin ] || fail "Dependency log not created."
+
+# Without the log the dependencies must be read again from the compiler output.
+rm meiquedeps.bin
+sleep 1
+echo -e "#define MESSAGE \"MODIFIED\"\\n" > ../header.h;
+
+$MEIQUE || fail "Basic compilation failed."
+
+EXE=`./exe` || fail "Target not compiled!?"
+if [ $EXE != "MODIFIED" ]
+then
+    fail "The target should be recompiled using the dependencies from the .d file, but wasn't."
+fi
+
+# A truncated log must be discarded only from the broken record on.
+truncate -s -3 meiquedeps.bin
+sleep 1
+echo -e "#define MESSAGE \"MODIFIED_AGAIN\"\\n" > ../header.h;
+
+$MEIQUE || fail "Compilation with a truncated dependency log failed."
+
+EXE=`./exe` || fail "Target not compiled!?"
+if [ $EXE != "MODIFIED_AGAIN" ]
+then
+    fail "The target should be recompiled after the dependency log got truncated, but wasn't."
+fi
@@ -0,0 +1,6 @@
+#include <iostream>
+#include "header.h"
+
+int main() {
+    std::cout << MESSAGE;
+}
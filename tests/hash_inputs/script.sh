@@ -0,0 +1,23 @@
+$MEIQUE --hash-inputs .. || fail "Failed to compile."
+EXE_TIME=`stat -c %Y exe`
+
+# Touching a file without changing it must not cause a rebuild.
+sleep 1
+touch ../header.h ../main.cpp
+
+$MEIQUE --hash-inputs || fail "Build after touching the sources failed."
+if [ `stat -c %Y exe` != $EXE_TIME ]
+then
+    fail "The target was rebuilt, but its sources didn't change."
+fi
+
+sleep 1
+echo -e "#define MESSAGE \"MODIFIED\"\\n" > ../header.h;
+
+$MEIQUE --hash-inputs || fail "Build after changing the header failed."
+
+EXE=`./exe` || fail "Target not compiled!?"
+if [ $EXE != "MODIFIED" ]
+then
+    fail "The target should be recompiled after the header contents changed, but wasn't."
+fi
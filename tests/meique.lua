@@ -18,6 +18,18 @@ local tests = [[
     basic_header_dependence
     change_compiler_flags
     lua_lock
+    deps_log_recovery
+    hash_inputs
+    custom_target_restat
+    shared_lib_interface
+    object_cache
+    remote_cache
+    relocatable_cache
+    precompiled_header
+    suggest_pch
+    watch_mode
+    build_server
+    shell_quoting
 ]]
 
 string.gsub(tests, '([^%s]+)', addMeiqueTest)
@@ -0,0 +1,8 @@
+#include <iostream>
+#include <suffix.h>
+#include "header.h"
+
+int main()
+{
+    std::cout << MESSAGE SUFFIX;
+}
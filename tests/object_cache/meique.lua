@@ -0,0 +1,3 @@
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
+exe:addCustomFlags("-isystem "..sourceDir().."system")
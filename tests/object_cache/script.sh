@@ -0,0 +1,43 @@
+export MEIQUE_CACHE_DIR=$PWD/../cache
+$MEIQUE --cache .. || fail "Failed to compile."
+$MEIQUE --cache-stats | grep "Stored objects: *1$" || fail "The object wasn't stored in the cache."
+
+# A clean build fetches the object from the cache.
+$MEIQUE -c || fail "Failed to clean."
+$MEIQUE --cache | grep "Compiling main.cpp" && fail "The object should be fetched from the cache."
+$MEIQUE --cache-stats | grep "Hits: *1$" || fail "The cache hit wasn't counted."
+EXE=`./exe` || fail "Target not linked!?"
+if [ $EXE != "ORIGINAL" ]
+then
+    fail "Wrong object fetched from the cache."
+fi
+
+# The header contents are part of the key.
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../header.h
+$MEIQUE --cache || fail "Build after changing the header failed."
+EXE=`./exe` || fail "Target not linked!?"
+if [ $EXE != "MODIFIED" ]
+then
+    fail "The object should be compiled again after the header changed, but wasn't."
+fi
+
+# Going back to the original header is a cache hit again.
+sleep 1
+echo '#define MESSAGE "ORIGINAL"' > ../header.h
+$MEIQUE --cache | grep "Compiling main.cpp" && fail "The original object should be fetched from the cache."
+EXE=`./exe` || fail "Target not linked!?"
+if [ $EXE != "ORIGINAL" ]
+then
+    fail "Wrong object fetched from the cache after restoring the header."
+fi
+
+# Headers in system directories are part of the key too.
+echo '#define SUFFIX "!"' > ../system/suffix.h
+$MEIQUE -c || fail "Failed to clean."
+$MEIQUE --cache || fail "Build after changing the system header failed."
+EXE=`./exe` || fail "Target not linked!?"
+if [ $EXE != "ORIGINAL!" ]
+then
+    fail "The object should be compiled again after the system header changed, but was fetched from the cache."
+fi
@@ -0,0 +1 @@
+#define SUFFIX ""
@@ -0,0 +1,6 @@
+// Everything comes from the precompiled header.
+int main()
+{
+    std::string message(MESSAGE);
+    std::cout << message;
+}
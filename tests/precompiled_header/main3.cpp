@@ -0,0 +1,7 @@
+#include "pch.h"
+
+int main()
+{
+    std::string message(MESSAGE);
+    std::cout << message;
+}
@@ -0,0 +1,14 @@
+exe = Executable:new("exe")
+exe:setPrecompiledHeader("pch.h")
+exe:addFiles("main.cpp")
+
+-- Same flags, so it uses the precompiled header of exe.
+exe2 = Executable:new("exe2")
+exe2:setPrecompiledHeader(exe)
+exe2:addFiles("main2.cpp")
+
+-- Headers may be found elsewhere, so it can't use the precompiled header of exe.
+exe3 = Executable:new("exe3")
+exe3:setPrecompiledHeader(exe)
+exe3:addIncludePath("other")
+exe3:addFiles("main3.cpp")
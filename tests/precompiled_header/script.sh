@@ -0,0 +1,22 @@
+$MEIQUE .. > output.log 2>&1 || { cat output.log; fail "Failed to compile."; }
+cat output.log
+[ `grep -c "Precompiling pch.h" output.log` = 1 ] || fail "The header should be precompiled once."
+ls pch.h.exe.gch || fail "The precompiled header wasn't created."
+grep "different settings\|not used because" output.log && fail "The precompiled header wasn't used."
+[ `./exe` = "ORIGINAL" ] || fail "Wrong exe output."
+[ `./exe2` = "ORIGINAL" ] || fail "Wrong exe2 output."
+grep "exe3 can't use the precompiled header of exe" output.log || fail "exe3 has other include paths, it can't use the precompiled header."
+[ `./exe3` = "ORIGINAL" ] || fail "Wrong exe3 output."
+
+# Headers included by the precompiled header are dependencies of all files using it.
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../header.h
+$MEIQUE > output.log 2>&1 || { cat output.log; fail "Failed to compile after changing the header."; }
+cat output.log
+grep "Precompiling pch.h" output.log || fail "The header should be precompiled again."
+grep "Compiling main2.cpp" output.log || fail "Files of the target sharing the precompiled header should be compiled again."
+[ `./exe` = "MODIFIED" ] || fail "exe wasn't rebuilt."
+[ `./exe2` = "MODIFIED" ] || fail "exe2 wasn't rebuilt."
+
+$MEIQUE | grep "Compiling\|Precompiling" && fail "Nothing should be built."
+exit 0
@@ -0,0 +1,9 @@
+#include <iostream>
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+int main()
+{
+    std::cout << TO_STRING(DATA_DIR);
+}
@@ -0,0 +1,7 @@
+#include <iostream>
+#include "header.h"
+
+int main()
+{
+    std::cout << MESSAGE << ' ' << __FILE__;
+}
@@ -0,0 +1,7 @@
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
+
+-- The directory has the source directory as prefix, but isn't inside it.
+data = Executable:new("data")
+data:addFiles("data.cpp")
+data:addCustomFlags("-DDATA_DIR="..string.sub(sourceDir(), 1, -2).."-data")
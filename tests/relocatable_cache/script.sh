@@ -0,0 +1,36 @@
+export MEIQUE_CACHE_DIR=$PWD/../cache
+# Two checkouts of the same project in different directories.
+for dir in first second; do
+    mkdir -p ../$dir/build
+    cp ../main.cpp ../data.cpp ../header.h ../meique.lua ../$dir/
+done
+
+cd ../first/build
+$MEIQUE -s --debug --relocatable .. || fail "Failed to configure."
+$MEIQUE --cache || fail "Failed to compile."
+grep -q "$(dirname $PWD)" main.cpp.exe.o && fail "The object has the absolute source directory."
+grep -q "$PWD" main.cpp.exe.o && fail "The object has the absolute build directory."
+EXE=`./exe` || fail "Target not linked!?"
+if [ "$EXE" != "ORIGINAL ../main.cpp" ]
+then
+    fail "__FILE__ should be relative to the build directory."
+fi
+
+# The other checkout reuses the object.
+cd ../../second/build
+$MEIQUE -s --debug --relocatable .. || fail "Failed to configure the second checkout."
+$MEIQUE --cache > output.log || { cat output.log; fail "Failed to compile the second checkout."; }
+cat output.log
+grep "Compiling main.cpp" output.log && fail "The object should be fetched from the cache."
+[ "`./data`" = "$(dirname $PWD)-data" ] || fail "An object with the directory of the first checkout was fetched from the cache."
+cmp main.cpp.exe.o ../../first/build/main.cpp.exe.o || fail "Wrong object fetched from the cache."
+
+# Its own header is checked, not the one of the first checkout.
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../header.h
+$MEIQUE --cache | grep "Compiling main.cpp" || fail "The object should be compiled again after the header changed."
+EXE=`./exe` || fail "Target not linked!?"
+if [ "$EXE" != "MODIFIED ../main.cpp" ]
+then
+    fail "Wrong object after changing the header."
+fi
@@ -0,0 +1,32 @@
+SERVER=`dirname ${MEIQUE%% *}`/cacheserver/meique-cache-server
+SOCKET=$PWD/../cache.sock
+$SERVER --listen=unix:$SOCKET --dir=$PWD/../cache &
+SERVER_PID=$!
+trap "kill $SERVER_PID" EXIT
+sleep 1
+
+$MEIQUE --remote-cache=unix:$SOCKET .. || fail "Failed to compile."
+ls ../cache | grep "^o_" || fail "The object wasn't uploaded to the remote cache."
+
+# A build from scratch, as on another machine, fetches the object from the server.
+cd .. && rm -rf build && mkdir build && cd build
+$MEIQUE --remote-cache=unix:$SOCKET .. | grep "Compiling main.cpp" && fail "The object should be fetched from the remote cache."
+EXE=`./exe` || fail "Target not linked!?"
+if [ $EXE != "ORIGINAL" ]
+then
+    fail "Wrong object fetched from the remote cache."
+fi
+
+# A dead server doesn't break the build.
+kill $SERVER_PID
+trap - EXIT
+$MEIQUE -c || fail "Failed to clean."
+$MEIQUE --remote-cache=unix:$SOCKET | grep "Compiling main.cpp" || fail "The object should be compiled without the remote cache."
+
+# Jobs with a remote cache start in a worker thread, running out of file descriptors there only fails the job.
+for limit in 8 9 10 11 12; do
+    $MEIQUE -c > /dev/null
+    (ulimit -n $limit; $MEIQUE -j1 --remote-cache=unix:$SOCKET > output.log 2>&1)
+    [ $? -le 1 ] || { cat output.log; fail "The build crashed with $limit file descriptors."; }
+done
+exit 0
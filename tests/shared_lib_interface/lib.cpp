@@ -0,0 +1,6 @@
+#include "lib.h"
+
+EXPORT const char* message()
+{
+    return "ORIGINAL";
+}
@@ -0,0 +1 @@
+#define EXPORT __attribute__((visibility("default")))
@@ -0,0 +1,8 @@
+#include <iostream>
+
+const char* message();
+
+int main()
+{
+    std::cout << message();
+}
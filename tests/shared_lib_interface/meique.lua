@@ -0,0 +1,6 @@
+lib = Library:new("lib")
+lib:addFiles("lib.cpp")
+
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
+exe:use(lib)
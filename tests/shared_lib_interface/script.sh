@@ -0,0 +1,40 @@
+$MEIQUE .. || fail "Failed to compile."
+EXE_TIME=`stat -c %Y exe`
+
+# Changing only the implementation of the library must not relink its users.
+sleep 1
+echo -e '#include "lib.h"\nEXPORT const char* message() { return "MODIFIED"; }' > ../lib.cpp
+
+$MEIQUE || fail "Build after changing the library implementation failed."
+if [ `stat -c %Y exe` != $EXE_TIME ]
+then
+    fail "The executable was relinked, but the library interface didn't change."
+fi
+EXE=`./exe` || fail "Target not compiled!?"
+if [ $EXE != "MODIFIED" ]
+then
+    fail "The library should be relinked, but wasn't."
+fi
+
+# A new exported symbol changes the interface.
+sleep 1
+echo -e '#include "lib.h"\nEXPORT const char* message() { return "MODIFIED"; }\nEXPORT int newFunction() { return 0; }' > ../lib.cpp
+
+$MEIQUE || fail "Build after changing the library interface failed."
+if [ `stat -c %Y exe` = $EXE_TIME ]
+then
+    fail "The executable should be relinked after the library interface changed, but wasn't."
+fi
+
+# An old snapshot of the build, e.g. left by an interrupted build, must notice the new library interface.
+cp meiquegraph.bin meiquegraph.bin.old || fail "No build snapshot saved."
+EXE_TIME=`stat -c %Y exe`
+sleep 1
+echo -e '#include "lib.h"\nEXPORT const char* message() { return "MODIFIED"; }\nEXPORT int otherFunction() { return 0; }' > ../lib.cpp
+$MEIQUE lib || fail "Build of the library alone failed."
+mv meiquegraph.bin.old meiquegraph.bin
+$MEIQUE || fail "Build with an old snapshot failed."
+if [ `stat -c %Y exe` = $EXE_TIME ]
+then
+    fail "The executable should be relinked after the library interface changed, but the old snapshot was used."
+fi
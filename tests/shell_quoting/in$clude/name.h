@@ -0,0 +1 @@
+#define NAME "World"
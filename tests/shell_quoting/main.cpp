@@ -0,0 +1,7 @@
+#include <iostream>
+#include "name.h"
+
+int main()
+{
+    std::cout << GREETING << ' ' << NAME;
+}
@@ -0,0 +1,6 @@
+exe = Executable:new("exe")
+exe:addFiles("main.cpp")
+-- Flags written by users are shell text, with them the compiler runs in a shell...
+exe:addCustomFlags([['-DGREETING="Hello"']])
+-- ...that must pass the paths written by meique untouched.
+exe:addIncludePath("in$clude")
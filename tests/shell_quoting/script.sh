@@ -0,0 +1,4 @@
+$MEIQUE .. > output.log 2>&1 || { cat output.log; fail "Failed to compile."; }
+cat output.log
+[ "`./exe`" = "Hello World" ] || fail "Wrong exe output."
+exit 0
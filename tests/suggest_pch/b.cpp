@@ -0,0 +1,3 @@
+#include "common.h"
+#include <vector>
+int b() { return message().size(); }
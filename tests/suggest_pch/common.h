@@ -0,0 +1,2 @@
+#include <string>
+inline std::string message() { return "common"; }
@@ -0,0 +1,6 @@
+#include "common.h"
+#include <vector>
+#include "rare.h"
+int a();
+int b();
+int main() { return a() + b() + rare() - 13; }
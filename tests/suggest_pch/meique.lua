@@ -0,0 +1,6 @@
+exe = Executable:new("exe")
+exe:addFiles([[
+    main.cpp
+    a.cpp
+    b.cpp
+]])
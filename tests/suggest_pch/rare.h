@@ -0,0 +1 @@
+inline int rare() { return 1; }
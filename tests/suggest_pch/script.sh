@@ -0,0 +1,14 @@
+$MEIQUE -s .. > output.log 2>&1 || { cat output.log; fail "Failed to configure."; }
+$MEIQUE --suggest-pch exe > output.log 2>&1 || { cat output.log; fail "Failed to run without a build."; }
+cat output.log
+grep "build it first" output.log || fail "Suggesting a precompiled header without compiling anything should fail."
+
+$MEIQUE > output.log 2>&1 || { cat output.log; fail "Failed to compile."; }
+$MEIQUE --suggest-pch exe > output.log 2>&1 || { cat output.log; fail "Failed to suggest a precompiled header."; }
+cat output.log
+grep '#include "common.h"' output.log || fail "common.h is included by all files."
+grep '#include <vector>' output.log || fail "<vector> is included by all files."
+grep 'stl_vector.h' output.log && fail "Headers included through other headers aren't candidates."
+grep '#include "rare.h"' output.log && fail "rare.h is included by a single file."
+grep "Compiling" output.log && fail "Nothing should be built."
+exit 0
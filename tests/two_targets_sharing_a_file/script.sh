@@ -1,5 +1,6 @@
 $MEIQUE .. lib
-$MEIQUE exe
+$MEIQUE exe > output.log 2>&1 || { cat output.log; fail "Failed to compile exe."; }
+grep "Waiting for unfinished jobs" output.log && fail "A successful build shouldn't wait for unfinished jobs."
 
 EXE=`./exe` || fail "Target not compiled!?"
 if [ $EXE != "EXECUTABLE" ]
@@ -0,0 +1,27 @@
+$MEIQUE -s .. || fail "Failed to configure."
+export REAL_CXX=`command -v g++`
+export PATH=$PWD/../bin:$PATH
+
+# The header is saved while main.cpp is compiled with its old contents.
+touch ../hold
+$MEIQUE --watch > output.log 2>&1 &
+WATCH=$!
+trap "kill $WATCH" EXIT
+for i in `seq 100`; do
+    [ -f ../compiling ] && break
+    sleep 0.1
+done
+[ -f ../compiling ] || { cat output.log; fail "main.cpp wasn't compiled."; }
+sleep 1
+echo '#define MESSAGE "MODIFIED"' > ../header.h
+rm ../hold
+
+# Without changes during the second build, it waits for the next one.
+for i in `seq 100`; do
+    grep -q "Watching for changes" output.log && break
+    sleep 0.1
+done
+cat output.log
+[ `grep -c "Compiling main.cpp" output.log` = 2 ] || fail "main.cpp should be compiled again, the header changed during the first build."
+[ `./exe` = "MODIFIED" ] || fail "exe wasn't rebuilt."
+exit 0